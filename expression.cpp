@@ -1,47 +1,781 @@
 #include <iostream>
 #include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <list>
+#include <charconv>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define EXPRESSION_JIT 1
+#endif
 
 
+class Wyrazenie;
+
+// Wyrazenie skompilowane do ciagu instrukcji w odwrotnej notacji polskiej.
+// Wspoldzielony wezel liczymy raz: ZAPISZ kopiuje szczyt stosu do komorki,
+// a kolejne wystapienia wezla to WCZYTAJ z tej komorki. Komorki dostaja tylko
+// wezly, ktore w tym wyrazeniu maja wiecej niz jednego rodzica i nie sa lisciami.
+enum class Kod : unsigned char { STALA, ZMIENNA, SUMA, RAZY, SIN, COS, ZAPISZ, WCZYTAJ };
+
+struct Instrukcja {
+    Kod kod;
+    int komorka;  // ZAPISZ / WCZYTAJ; dla ZMIENNA - numer zmiennej
+    double stala; // tylko dla STALA
+};
+
+class Program {
+    std::vector<Instrukcja> instrukcje;
+    int glebokosc = 0;     // ile wartosci lezy na stosie po dotychczasowych instrukcjach
+    int max_glebokosc = 0;
+    int komorek = 0;
+    std::unordered_map<const Wyrazenie*, int> policzone; // wspoldzielony wezel -> komorka
+public:
+    void dodaj(Kod kod, double stala = 0, int komorka = 0) {
+        instrukcje.push_back({kod, komorka, stala});
+        if (kod == Kod::STALA || kod == Kod::ZMIENNA || kod == Kod::WCZYTAJ) ++glebokosc;
+        else if (kod == Kod::SUMA || kod == Kod::RAZY) --glebokosc;
+        max_glebokosc = std::max(max_glebokosc, glebokosc);
+    }
+    void wezel(Wyrazenie* w); // dopisuje w (wspoldzielony - tylko raz)
+    // Po skompilowaniu calego wyrazenia: usuwa komorki, ktorych nikt nie wczytuje
+    // (wezel mial w tym wyrazeniu jednego rodzica), a wczytanie liscia zamienia
+    // na sam lisc. Pozostale komorki dostaja kolejne numery.
+    void usun_zbedne_komorki() {
+        std::vector<int> wczytan(komorek, 0);
+        for (const Instrukcja& in : instrukcje)
+            if (in.kod == Kod::WCZYTAJ) ++wczytan[in.komorka];
+        std::vector<int> nowa(komorek, -1);
+        std::vector<Instrukcja> lisc(komorek), wynik;
+        std::vector<bool> jest_lisciem(komorek, false);
+        int zostalo = 0;
+        for (const Instrukcja& in : instrukcje) {
+            if (in.kod == Kod::ZAPISZ) {
+                const Instrukcja& poprzednia = wynik.back();
+                if (wczytan[in.komorka] == 0) continue;
+                if (poprzednia.kod == Kod::STALA || poprzednia.kod == Kod::ZMIENNA) {
+                    lisc[in.komorka] = poprzednia;
+                    jest_lisciem[in.komorka] = true;
+                    continue;
+                }
+                nowa[in.komorka] = zostalo++;
+                wynik.push_back({Kod::ZAPISZ, nowa[in.komorka], 0});
+            } else if (in.kod == Kod::WCZYTAJ) {
+                if (jest_lisciem[in.komorka]) wynik.push_back(lisc[in.komorka]);
+                else wynik.push_back({Kod::WCZYTAJ, nowa[in.komorka], 0});
+            } else {
+                wynik.push_back(in);
+            }
+        }
+        for (auto it = policzone.begin(); it != policzone.end(); ) {
+            if (nowa[it->second] < 0) it = policzone.erase(it);
+            else { it->second = nowa[it->second]; ++it; }
+        }
+        instrukcje.swap(wynik);
+        komorek = zostalo;
+    }
+    const std::vector<Instrukcja>& kod() const { return instrukcje; }
+    int rozmiar_stosu() const { return max_glebokosc; }
+    int liczba_komorek() const { return komorek; }
+    // Komorka wezla w (wspoldzielonego w tym wyrazeniu) albo -1
+    int komorka(const Wyrazenie* w) const {
+        auto it = policzone.find(w);
+        return it == policzone.end() ? -1 : it->second;
+    }
+
+    // Te same dzialania w tej samej kolejnosci co oblicz_wartosc na drzewie,
+    // wiec wynik jest identyczny
+    double oblicz(double x) const {
+        if (instrukcje.empty()) return 0;
+        double maly[64];
+        std::vector<double> duzy;
+        double* stos = maly;
+        if (max_glebokosc + komorek > 64) { duzy.resize(max_glebokosc + komorek); stos = duzy.data(); }
+        double* pamiec = stos + max_glebokosc;
+        int n = 0;
+        for (const Instrukcja& in : instrukcje) {
+            switch (in.kod) {
+            case Kod::STALA:   stos[n++] = in.stala; break;
+            case Kod::ZMIENNA: stos[n++] = x; break;
+            case Kod::SUMA:    --n; stos[n - 1] = stos[n - 1] + stos[n]; break;
+            case Kod::RAZY:    --n; stos[n - 1] = stos[n - 1] * stos[n]; break;
+            case Kod::SIN:     stos[n - 1] = sin(stos[n - 1]); break;
+            case Kod::COS:     stos[n - 1] = cos(stos[n - 1]); break;
+            case Kod::ZAPISZ:  pamiec[in.komorka] = stos[n - 1]; break;
+            case Kod::WCZYTAJ: stos[n++] = pamiec[in.komorka]; break;
+            }
+        }
+        return stos[0];
+    }
+};
+
+
+// Program przetlumaczony na kod maszynowy x86-64 (w pamieci wykonywalnej).
+// Stos programu lezy w tablicy roboczej, a kazda instrukcja to kilka rozkazow
+// na stalych przesunieciach w tej tablicy - bez petli i switcha interpretera.
+// Wersja skalarna liczy jeden punkt, wektorowa dwa naraz (addpd/mulpd),
+// sin/cos wolaja te same funkcje z libm, wiec wyniki sa takie jak w Program::oblicz.
+// Na innych platformach obliczenia wykonuje Program.
+class ProgramNatywny {
+    Program program;
+    int komorek_roboczych; // x, stos, komorki ZAPISZ/WCZYTAJ
+    void* pamiec = nullptr;
+    std::size_t rozmiar = 0;
+    double (*skalarny)(double x, double* robocza) = nullptr;
+    void (*wektorowy)(double* robocza) = nullptr; // robocza[0..1] = x, wynik w robocza[2..3]
+
+#ifdef EXPRESSION_JIT
+    struct Emiter {
+        std::vector<unsigned char> kod;
+        void bajty(std::initializer_list<unsigned char> b) { kod.insert(kod.end(), b); }
+        void liczba32(std::int32_t v) { unsigned char b[4]; std::memcpy(b, &v, 4); kod.insert(kod.end(), b, b + 4); }
+        void liczba64(std::uint64_t v) { unsigned char b[8]; std::memcpy(b, &v, 8); kod.insert(kod.end(), b, b + 8); }
+        // <prefiks> 0F <op> [rdi + przes], xmm0
+        void sse(unsigned char prefiks, unsigned char op, std::int32_t przes) { bajty({prefiks, 0x0F, op, 0x87}); liczba32(przes); }
+        void stala(std::int32_t przes, double v) {
+            std::uint64_t b; std::memcpy(&b, &v, 8);
+            bajty({0x48, 0xB8}); liczba64(b);         // mov rax, imm64
+            bajty({0x48, 0x89, 0x87}); liczba32(przes); // mov [rdi + przes], rax
+        }
+        void wywolaj(double (*f)(double)) {
+            bajty({0x57});                            // push rdi (i wyrownanie stosu do 16)
+            bajty({0x48, 0xB8}); liczba64(reinterpret_cast<std::uint64_t>(f));
+            bajty({0xFF, 0xD0});                      // call rax
+            bajty({0x5F});                            // pop rdi
+        }
+    };
+
+    // szer - liczba punktow naraz (1 albo 2); komorka robocza ma 8 * szer bajtow
+    std::vector<unsigned char> generuj(int szer) const {
+        const unsigned char SD = 0xF2, PD = 0x66;
+        const unsigned char LADUJ = 0x10, ZAPISZ = 0x11, DODAJ = 0x58, MNOZ = 0x59;
+        unsigned char pref = szer == 1 ? SD : PD;
+        auto stos = [&](int i) { return static_cast<std::int32_t>(8 * szer * (1 + i)); };
+        auto komorka = [&](int k) { return stos(program.rozmiar_stosu() + k); };
+        double (*sinus_libm)(double) = &::sin;
+        double (*cosinus_libm)(double) = &::cos;
+        Emiter e;
+        if (szer == 1) e.sse(SD, ZAPISZ, 0); // x przychodzi w xmm0
+        int n = 0;
+        for (const Instrukcja& in : program.kod()) {
+            switch (in.kod) {
+            case Kod::STALA:
+                for (int l = 0; l < szer; ++l) e.stala(stos(n) + 8 * l, in.stala);
+                ++n;
+                break;
+            case Kod::ZMIENNA: e.sse(pref, LADUJ, 0); e.sse(pref, ZAPISZ, stos(n++)); break;
+            case Kod::WCZYTAJ: e.sse(pref, LADUJ, komorka(in.komorka)); e.sse(pref, ZAPISZ, stos(n++)); break;
+            case Kod::ZAPISZ:  e.sse(pref, LADUJ, stos(n - 1)); e.sse(pref, ZAPISZ, komorka(in.komorka)); break;
+            case Kod::SUMA:
+            case Kod::RAZY:
+                --n;
+                e.sse(pref, LADUJ, stos(n - 1));
+                e.sse(pref, in.kod == Kod::SUMA ? DODAJ : MNOZ, stos(n));
+                e.sse(pref, ZAPISZ, stos(n - 1));
+                break;
+            case Kod::SIN:
+            case Kod::COS:
+                for (int l = 0; l < szer; ++l) {
+                    e.sse(SD, LADUJ, stos(n - 1) + 8 * l);
+                    e.wywolaj(in.kod == Kod::SIN ? sinus_libm : cosinus_libm);
+                    e.sse(SD, ZAPISZ, stos(n - 1) + 8 * l);
+                }
+                break;
+            }
+        }
+        if (szer == 1) e.sse(SD, LADUJ, stos(0)); // wynik w xmm0
+        e.bajty({0xC3});                          // ret
+        return e.kod;
+    }
+#endif
+
+public:
+    explicit ProgramNatywny(const Program& p)
+        : program(p), komorek_roboczych(1 + p.rozmiar_stosu() + p.liczba_komorek()) {
+#ifdef EXPRESSION_JIT
+        if (program.kod().empty()) return;
+        std::vector<unsigned char> k1 = generuj(1), k2 = generuj(2);
+        rozmiar = k1.size() + k2.size();
+        void* m = mmap(nullptr, rozmiar, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) return;
+        std::memcpy(m, k1.data(), k1.size());
+        std::memcpy(static_cast<unsigned char*>(m) + k1.size(), k2.data(), k2.size());
+        if (mprotect(m, rozmiar, PROT_READ | PROT_EXEC) != 0) { munmap(m, rozmiar); return; }
+        pamiec = m;
+        skalarny = reinterpret_cast<double (*)(double, double*)>(m);
+        wektorowy = reinterpret_cast<void (*)(double*)>(static_cast<unsigned char*>(m) + k1.size());
+#endif
+    }
+    ProgramNatywny(const ProgramNatywny&) = delete;
+    ProgramNatywny& operator=(const ProgramNatywny&) = delete;
+    ~ProgramNatywny() {
+#ifdef EXPRESSION_JIT
+        if (pamiec) munmap(pamiec, rozmiar);
+#endif
+    }
+
+    bool natywny() const { return pamiec != nullptr; }
+
+    double oblicz(double x) const {
+        if (!skalarny) return program.oblicz(x);
+        double maly[64];
+        std::vector<double> duzy;
+        double* robocza = maly;
+        if (komorek_roboczych > 64) { duzy.resize(komorek_roboczych); robocza = duzy.data(); }
+        return skalarny(x, robocza);
+    }
+
+    void oblicz_wartosci(const double* xs, double* out, std::size_t n) const {
+        if (!wektorowy) { for (std::size_t i = 0; i < n; ++i) out[i] = program.oblicz(xs[i]); return; }
+        std::vector<double> robocza(2 * komorek_roboczych);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            robocza[0] = xs[i]; robocza[1] = xs[i + 1];
+            wektorowy(robocza.data());
+            out[i] = robocza[2]; out[i + 1] = robocza[3];
+        }
+        if (i < n) out[i] = skalarny(xs[i], robocza.data());
+    }
+};
+
+
+// Wektorowe sin/cos dla oblicz_wartosci. Redukcja do [-pi/4, pi/4] po Cody-Waite'owsku:
+// k = round(x * 2/pi), a pi/2 w trzech 33-bitowych czesciach (pio2_1, pio2_2, pio2_3
+// z __ieee754_rem_pio2 w fdlibm), wiec k * PIO2_1 jest dokladne dla |k| < 2^20.
+// Na zredukowanym r wielomiany sincof/coscof z sin.c w Cephes: sin = r + r^3 P(r^2),
+// cos = 1 - r^2/2 + r^4 Q(r^2). Dla |x| <= ZAKRES_SIN_COS blad bezwzgledny jest < 1e-15
+// (kilka ulp), wiekszy x idzie przez std::sin/std::cos.
+// Petle nie maja rozgalezien, wiec kompilator zamienia je na instrukcje SIMD.
+const double ZAKRES_SIN_COS = 1e5;
+
+inline void sin_cos_blok(const double* xs, double* out, std::size_t n, bool cosinus) {
+    const double DWA_PRZEZ_PI = 0.636619772367581343076;
+    const double PIO2_1 = 1.57079632673412561417e+00;
+    const double PIO2_2 = 6.07710050630396597660e-11;
+    const double PIO2_3 = 2.02226624871116645580e-21;
+    const double ZAOKR  = 6755399441055744.0; // 1.5 * 2^52 - zaokraglenie do calkowitej
+    bool w_zakresie = true;
+    for (std::size_t i = 0; i < n; ++i) w_zakresie &= std::fabs(xs[i]) <= ZAKRES_SIN_COS;
+    if (!w_zakresie) {
+        for (std::size_t i = 0; i < n; ++i) out[i] = cosinus ? cos(xs[i]) : sin(xs[i]);
+        return;
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        double x = xs[i];
+        double k = (x * DWA_PRZEZ_PI + ZAOKR) - ZAOKR;
+        double r = ((x - k * PIO2_1) - k * PIO2_2) - k * PIO2_3;
+        double z = r * r;
+        double s = r + r * z * (((((1.58962301576546568060e-10 * z - 2.50507477628578072866e-8) * z
+                   + 2.75573136213857245213e-6) * z - 1.98412698295895385996e-4) * z
+                   + 8.33333333332211858878e-3) * z - 1.66666666666666307295e-1);
+        double c = 1.0 - 0.5 * z + z * z * (((((-1.13585365213876817300e-11 * z + 2.08757008419747316778e-9) * z
+                   - 2.75573141792967388112e-7) * z + 2.48015872888517045348e-5) * z
+                   - 1.38888888888730564116e-3) * z + 4.16666666666665929218e-2);
+        // cwiartka: cos(x) = sin(x + pi/2)
+        int q = static_cast<int>(k) + (cosinus ? 1 : 0);
+        double v = (q & 1) ? c : s;
+        out[i] = (q & 2) ? -v : v;
+    }
+}
+
+
+// Klucz wezla w tablicy wezli (hash-consing): rodzaj, stala i adresy dzieci
+struct KluczWezla {
+    Kod kod;
+    std::uint64_t stala; // bity liczby - 0.0 i -0.0 to rozne stale
+    Wyrazenie* a;
+    Wyrazenie* b;
+    bool operator==(const KluczWezla& k) const { return kod == k.kod && stala == k.stala && a == k.a && b == k.b; }
+};
+
+struct HashKlucza {
+    std::size_t operator()(const KluczWezla& k) const {
+        std::size_t h = std::hash<std::uint64_t>()(k.stala) ^ static_cast<std::size_t>(k.kod);
+        h = h * 31 + std::hash<const void*>()(k.a);
+        return h * 31 + std::hash<const void*>()(k.b);
+    }
+};
+
+class Pochodne;
+class Obliczenie;
+
+// Pamiec na wezly: bloki po 64 KiB pociete na kawalki jednej wielkosci (co 16 B),
+// zwolnione kawalki wracaja na liste wolnych. Bloki zyja do konca programu.
+// Przydzial i zwrot ida pod blokada_wezlow(), tak jak zmiany tablicy wezlow.
+inline std::recursive_mutex& blokada_wezlow() {
+    static std::recursive_mutex blokada;
+    return blokada;
+}
+
+class PulaWezlow {
+    static constexpr std::size_t KROK = 16, KLAS = 8, BLOK_BAJTOW = 1 << 16;
+    struct Wolny { Wolny* nastepny; };
+    Wolny* wolne[KLAS] = {};
+public:
+    static PulaWezlow& pula() {
+        static PulaWezlow* p = new PulaWezlow; // celowo bez niszczenia - wezly moga zyc dluzej
+        return *p;
+    }
+    void* przydziel(std::size_t rozmiar) {
+        std::size_t k = (rozmiar + KROK - 1) / KROK - 1;
+        if (k >= KLAS) return ::operator new(rozmiar);
+        std::lock_guard<std::recursive_mutex> b(blokada_wezlow());
+        if (!wolne[k]) {
+            std::size_t kawalek = (k + 1) * KROK;
+            char* blok = static_cast<char*>(::operator new(BLOK_BAJTOW));
+            for (std::size_t i = 0; i + kawalek <= BLOK_BAJTOW; i += kawalek) {
+                Wolny* w = reinterpret_cast<Wolny*>(blok + i);
+                w->nastepny = wolne[k];
+                wolne[k] = w;
+            }
+        }
+        Wolny* w = wolne[k];
+        wolne[k] = w->nastepny;
+        return w;
+    }
+    void oddaj(void* p, std::size_t rozmiar) {
+        std::size_t k = (rozmiar + KROK - 1) / KROK - 1;
+        if (k >= KLAS) { ::operator delete(p); return; }
+        std::lock_guard<std::recursive_mutex> b(blokada_wezlow());
+        Wolny* w = static_cast<Wolny*>(p);
+        w->nastepny = wolne[k];
+        wolne[k] = w;
+    }
+};
+
+// Liczba dualna: wartosc i pochodna po x
+struct Dualna {
+    double w;
+    double d;
+};
+
+// Wezly sa niezmienne i moga byc wspoldzielone przez wiele wyrazen - kazdy wezel
+// liczy odwolania do siebie. kopiuj() dodaje odwolanie, zwolnij() je oddaje.
+// Wezly tworzone funkcjami stala(), zmienna(), suma(), iloczyn(), sinus(), cosinus()
+// (tak tez buduje je pochodna()) sa w tablicy wezli: takie samo wyrazenie
+// powstaje tylko raz. Tworzenie i usuwanie wezlow (tablica, pula) idzie pod
+// blokada_wezlow(), a licznik odwolan jest atomowy - wyrazenia mozna budowac
+// i zwalniac w wielu watkach.
+// Wyrazenie przy pierwszym obliczeniu kompiluje sie do Programu (raz, potem
+// program jest trzymany w korzeniu). oblicz_wartosc wykonuje ten program, a inne
+// obliczenia (oblicz, bloki, dualne, taylor) ida przez Obliczenie, ktore
+// zapamietuje wyniki tylko wezlow z komorka w programie - wspoldzielony wezel
+// liczymy raz na wywolanie, a nie raz na kazda droge do niego.
 class Wyrazenie {
 public:
     virtual void wypisz() =0;
-    virtual Wyrazenie* pochodna() =0;
-    virtual double oblicz_wartosc(double x) =0;
-    double calka_numeryczna(double lewy, double prawy,int dokl){
-        double wynik = 0;
-        double przedzial = (prawy - lewy) / dokl;
-        for (int i = 0; i < dokl; ++i){
-            double x = lewy + i/dokl * prawy;
-            double y = lewy + (i+1)/dokl * prawy;
-            wynik += (x + y)/2 * przedzial;
-        }
-        return wynik;
-    };
-    virtual Wyrazenie* kopiuj() = 0;
-    virtual ~Wyrazenie() {};
+    Wyrazenie* pochodna(int zmienna = 0); // po zmiennej nr zmienna; nowe odwolanie (zwolnic przez zwolnij)
+    virtual Wyrazenie* pochodna_wezla(Pochodne& d) =0;
+    double oblicz_wartosc(double x); // wszystkie zmienne = x
+    double oblicz(const double* zmienne); // zmienna nr i = zmienne[i]
+    // out[i] = wartosc w xs[i]; liczy blokami po BLOK punktow
+    static constexpr std::size_t BLOK = 256;
+    void oblicz_wartosci(const double* xs, double* out, std::size_t n) {
+        for (std::size_t i = 0; i < n; i += BLOK) oblicz_blok(xs + i, out + i, std::min(BLOK, n - i));
+    }
+    void oblicz_blok(const double* xs, double* out, std::size_t n); // n <= BLOK
+    // Jeden wezel w obliczeniu o - dzieci licza sie przez o (patrz Obliczenie)
+    virtual double wartosc_wezla(Obliczenie& o) =0;
+    virtual void blok_wezla(Obliczenie& o, double* out) =0;
+    virtual Dualna dualna_wezla(Obliczenie& o) =0;
+    virtual void blok_dualny_wezla(Obliczenie& o, double* w, double* d) =0;
+    virtual void taylor_wezla(Obliczenie& o, double* c) =0;
+
+    // Rozniczkowanie w przod - wartosc i pochodne w jednym przejsciu, bez budowania drzewa pochodnej
+    Dualna oblicz_z_pochodna(double x) { return oblicz_dualnie(x); }
+    // wartosci[i], pochodne[i] w xs[i]
+    void oblicz_z_pochodna(const double* xs, double* wartosci, double* pochodne, std::size_t n) {
+        for (std::size_t i = 0; i < n; i += BLOK)
+            oblicz_blok_dualnie(xs + i, wartosci + i, pochodne + i, std::min(BLOK, n - i));
+    }
+    // wyniki[k] = k-ta pochodna w x dla k = 0..rzad; 0 <= rzad <= MAX_RZAD,
+    // inaczej std::invalid_argument (tablice robocze wezlow maja MAX_RZAD + 1 miejsc)
+    static constexpr int MAX_RZAD = 16;
+    void pochodne_w_punkcie(double x, double* wyniki, int rzad) {
+        taylor(x, wyniki, rzad);
+        double silnia = 1;
+        for (int k = 1; k <= rzad; ++k) wyniki[k] *= (silnia *= k);
+    }
+    Dualna oblicz_dualnie(double x);
+    void oblicz_blok_dualnie(const double* xs, double* w, double* d, std::size_t n); // n <= BLOK
+    void taylor(double x, double* c, int rzad); // c[k] = f^(k)(x) / k!; rzad jak wyzej
+    // Calki na [lewy, prawy]; dokl - liczba podprzedzialow (> 0, dla Simpsona
+    // nieparzysta zaokraglana w gore), granice skonczone - inaczej std::invalid_argument
+    double calka_numeryczna(double lewy, double prawy, int dokl); // wzor prostokatow (srodki)
+    double calka_simpson(double lewy, double prawy, int dokl);
+    double calka_gauss(double lewy, double prawy, int dokl);      // Gauss-Legendre, 5 wezlow
+    // Gauss z podzialem przedzialow tam, gdzie blad jest za duzy. Przedzial jest
+    // najpierw dzielony na KAWALKOW_CALKI kawalkow, ktore pobieraja watki (0 - tyle,
+    // ile rdzeni); wynik nie zalezy od liczby watkow. Kawalek nie zejdzie ponizej
+    // bledu wzglednego ~1e-15 i liczy najwyzej BUDZET_CALKI przedzialow Gaussa.
+    // tolerancja > 0, granice skonczone - inaczej std::invalid_argument.
+    static constexpr int KAWALKOW_CALKI = 64;
+    static constexpr long BUDZET_CALKI = 1L << 16;
+    double calka_adaptacyjna(double lewy, double prawy, double tolerancja, unsigned watki = 0);
+    Wyrazenie* kopiuj() { odwolan.fetch_add(1, std::memory_order_relaxed); return this; }
+    int odwolania() const { return odwolan; }
+    virtual void kompiluj(Program& p) = 0; // dopisuje instrukcje liczace to wyrazenie
+    Program skompiluj() { Program p; p.wezel(this); p.usun_zbedne_komorki(); return p; }
+    const Program& program(); // skompiluj() - liczone raz na wezel
+    static void* operator new(std::size_t rozmiar) { return PulaWezlow::pula().przydziel(rozmiar); }
+    static void operator delete(void* p, std::size_t rozmiar) { PulaWezlow::pula().oddaj(p, rozmiar); }
+protected:
+    // Wezel moze miec wielu wlascicieli, wiec usuwa go tylko zwolnij() - bez delete z zewnatrz
+    virtual ~Wyrazenie();
+private:
+    std::atomic<int> odwolan{1};
+    std::atomic<Program*> skompilowany{nullptr};
+    bool w_tablicy = false;
+    KluczWezla klucz;
+    friend void zwolnij(Wyrazenie* w);
+    template<typename T, typename... A> friend Wyrazenie* wezel(KluczWezla k, A... argumenty);
+};
+
+inline std::unordered_map<KluczWezla, Wyrazenie*, HashKlucza>& tablica_wezlow() {
+    static std::unordered_map<KluczWezla, Wyrazenie*, HashKlucza> tablica;
+    return tablica;
+}
+
+Wyrazenie::~Wyrazenie() {
+    if (w_tablicy) tablica_wezlow().erase(klucz);
+    delete skompilowany.load(std::memory_order_relaxed);
+}
+
+// Wezly sa niezmienne, wiec program raz zbudowany jest dobry do konca zycia wezla.
+// Dwa watki moga zbudowac go naraz - zostaje ten, ktory pierwszy sie wpisal.
+const Program& Wyrazenie::program() {
+    Program* p = skompilowany.load(std::memory_order_acquire);
+    if (p) return *p;
+    Program* nowy = new Program(skompiluj());
+    if (skompilowany.compare_exchange_strong(p, nowy, std::memory_order_acq_rel)) return *nowy;
+    delete nowy;
+    return *p;
+}
+
+// Pod blokada: inny watek nie znajdzie w tablicy wezla, ktory wlasnie usuwamy
+inline void zwolnij(Wyrazenie* w) {
+    if (w == nullptr) return;
+    std::lock_guard<std::recursive_mutex> b(blokada_wezlow());
+    if (--w->odwolan == 0) delete w;
+}
+
+// Istniejacy wezel o kluczu k albo nowy T(argumenty...). Przejmuje odwolania do dzieci.
+template<typename T, typename... A>
+Wyrazenie* wezel(KluczWezla k, A... argumenty) {
+    std::lock_guard<std::recursive_mutex> b(blokada_wezlow());
+    auto it = tablica_wezlow().find(k);
+    if (it != tablica_wezlow().end()) {
+        zwolnij(k.a);
+        zwolnij(k.b);
+        return it->second->kopiuj();
+    }
+    T* w = new T(argumenty...);
+    w->w_tablicy = true;
+    w->klucz = k;
+    tablica_wezlow().emplace(k, w);
+    return w;
+}
+
+// Pochodne wezlow w jednym wywolaniu pochodna() - wspoldzielony wezel
+// rozniczkujemy tylko raz
+class Pochodne {
+    std::unordered_map<Wyrazenie*, Wyrazenie*> gotowe;
+public:
+    const int zmienna; // rozniczkujemy po tej zmiennej
+    explicit Pochodne(int _zmienna = 0) : zmienna(_zmienna) {}
+    ~Pochodne() { for (auto& p : gotowe) zwolnij(p.second); }
+    Wyrazenie* operator()(Wyrazenie* w) {
+        auto it = gotowe.find(w);
+        if (it != gotowe.end()) return it->second->kopiuj();
+        Wyrazenie* d = w->pochodna_wezla(*this);
+        gotowe.emplace(w, d->kopiuj());
+        return d;
+    }
+};
+
+Wyrazenie* Wyrazenie::pochodna(int zmienna) {
+    Pochodne d(zmienna);
+    return d(this);
+}
+
+void Program::wezel(Wyrazenie* w) {
+    if (w->odwolania() == 1) { w->kompiluj(*this); return; }
+    auto it = policzone.find(w);
+    if (it != policzone.end()) { dodaj(Kod::WCZYTAJ, 0, it->second); return; }
+    w->kompiluj(*this);
+    policzone.emplace(w, komorek);
+    dodaj(Kod::ZAPISZ, 0, komorek++);
+}
+
+// Jedno obliczenie wyrazenia w punkcie (albo bloku punktow) - jak Pochodne dla
+// pochodna(): wspoldzielony wezel liczymy raz, kolejne wystapienia kopiuja wynik.
+// Ktore wezly sa wspoldzielone, mowi program korzenia (komorki) - wyniki leza
+// w tablicach pod numerem komorki, a wezel bez komorki liczymy od razu.
+class Obliczenie {
+    const Program& program;
+    std::vector<char> gotowe;     // komorka juz policzona
+    std::vector<Dualna> liczby;   // wartosc, dualne
+    std::vector<double> tablice;  // bloki, taylor: szerokosc liczb na komorke
+    std::size_t szerokosc;
+
+    int komorka(const Wyrazenie* w) const { return w->odwolania() == 1 ? -1 : program.komorka(w); }
+public:
+    double x = 0;                    // wartosc, dualne, taylor
+    const double* zmienne = nullptr; // oblicz(zmienne); nullptr - kazda zmienna = x
+    const double* xs = nullptr;      // bloki: n punktow
+    std::size_t n = 0;
+    int rzad = 0;                    // taylor: wspolczynniki 0..rzad
+
+    // szerokosc - ile liczb na wezel w blokach i taylorze (0 - obliczenie jednej liczby)
+    Obliczenie(const Program& _program, std::size_t _szerokosc)
+        : program(_program), gotowe(_program.liczba_komorek(), 0), szerokosc(_szerokosc) {
+        if (szerokosc) tablice.resize(gotowe.size() * szerokosc);
+        else liczby.resize(gotowe.size());
+    }
+
+    double wartosc(Wyrazenie* w) {
+        int k = komorka(w);
+        if (k < 0) return w->wartosc_wezla(*this);
+        if (!gotowe[k]) { liczby[k].w = w->wartosc_wezla(*this); gotowe[k] = 1; }
+        return liczby[k].w;
+    }
+    Dualna dualna(Wyrazenie* w) {
+        int k = komorka(w);
+        if (k < 0) return w->dualna_wezla(*this);
+        if (!gotowe[k]) { liczby[k] = w->dualna_wezla(*this); gotowe[k] = 1; }
+        return liczby[k];
+    }
+    void blok(Wyrazenie* w, double* out) {
+        int k = komorka(w);
+        if (k < 0) { w->blok_wezla(*this, out); return; }
+        double* zapisany = &tablice[k * szerokosc];
+        if (gotowe[k]) { std::copy(zapisany, zapisany + n, out); return; }
+        w->blok_wezla(*this, out);
+        std::copy(out, out + n, zapisany);
+        gotowe[k] = 1;
+    }
+    void blok_dualny(Wyrazenie* w, double* wart, double* poch) {
+        int k = komorka(w);
+        if (k < 0) { w->blok_dualny_wezla(*this, wart, poch); return; }
+        double* zapisany = &tablice[k * szerokosc];
+        if (gotowe[k]) {
+            std::copy(zapisany, zapisany + n, wart);
+            std::copy(zapisany + n, zapisany + 2 * n, poch);
+            return;
+        }
+        w->blok_dualny_wezla(*this, wart, poch);
+        std::copy(wart, wart + n, zapisany);
+        std::copy(poch, poch + n, zapisany + n);
+        gotowe[k] = 1;
+    }
+    void taylor(Wyrazenie* w, double* c) {
+        int k = komorka(w);
+        if (k < 0) { w->taylor_wezla(*this, c); return; }
+        double* zapisany = &tablice[k * szerokosc];
+        if (gotowe[k]) { std::copy(zapisany, zapisany + rzad + 1, c); return; }
+        w->taylor_wezla(*this, c);
+        std::copy(c, c + rzad + 1, zapisany);
+        gotowe[k] = 1;
+    }
 };
 
+double Wyrazenie::oblicz_wartosc(double x) {
+    return program().oblicz(x);
+}
+
+double Wyrazenie::oblicz(const double* zmienne) {
+    Obliczenie o(program(), 0);
+    o.zmienne = zmienne;
+    return o.wartosc(this);
+}
+
+void Wyrazenie::oblicz_blok(const double* xs, double* out, std::size_t n) {
+    Obliczenie o(program(), n);
+    o.xs = xs;
+    o.n = n;
+    o.blok(this, out);
+}
+
+Dualna Wyrazenie::oblicz_dualnie(double x) {
+    Obliczenie o(program(), 0);
+    o.x = x;
+    return o.dualna(this);
+}
+
+void Wyrazenie::oblicz_blok_dualnie(const double* xs, double* w, double* d, std::size_t n) {
+    Obliczenie o(program(), 2 * n);
+    o.xs = xs;
+    o.n = n;
+    o.blok_dualny(this, w, d);
+}
+
+void Wyrazenie::taylor(double x, double* c, int rzad) {
+    if (rzad < 0 || rzad > MAX_RZAD)
+        throw std::invalid_argument("taylor: rzad poza zakresem 0..MAX_RZAD");
+    Obliczenie o(program(), rzad + 1);
+    o.x = x;
+    o.rzad = rzad;
+    o.taylor(this, c);
+}
+
+
+namespace {
+const double GAUSS_WEZLY[5] = { 0.0, -0.5384693101056831, 0.5384693101056831,
+                                -0.9061798459386640, 0.9061798459386640 };
+const double GAUSS_WAGI[5]  = { 0.5688888888888889, 0.4786286704993665, 0.4786286704993665,
+                                0.2369268850561891, 0.2369268850561891 };
+
+double gauss_przedzial(Wyrazenie* w, double a, double b) {
+    double srodek = (a + b) / 2, pol = (b - a) / 2;
+    double xs[5], ys[5];
+    for (int i = 0; i < 5; ++i) xs[i] = srodek + pol * GAUSS_WEZLY[i];
+    w->oblicz_wartosci(xs, ys, 5);
+    double wynik = 0;
+    for (int i = 0; i < 5; ++i) wynik += GAUSS_WAGI[i] * ys[i];
+    return wynik * pol;
+}
+
+// budzet - ile przedzialow Gaussa zostalo jeszcze temu kawalkowi; po jego
+// wyczerpaniu (albo gdy tolerancja spadnie ponizej bledu zaokraglen) bierzemy
+// to, co jest, zamiast dzielic dalej
+double gauss_adaptacyjnie(Wyrazenie* w, double a, double b, double calosc, double tolerancja,
+                          int glebokosc, long& budzet) {
+    double m = (a + b) / 2;
+    double l = gauss_przedzial(w, a, m), p = gauss_przedzial(w, m, b);
+    budzet -= 2;
+    double blad = std::fabs(l + p - calosc);
+    if (glebokosc == 0 || budzet <= 0 || m <= a || m >= b
+        || !(blad > std::max(tolerancja, 1e-15 * std::fabs(l + p))))
+        return l + p;
+    double wynik = gauss_adaptacyjnie(w, a, m, l, tolerancja / 2, glebokosc - 1, budzet);
+    return wynik + gauss_adaptacyjnie(w, m, b, p, tolerancja / 2, glebokosc - 1, budzet);
+}
+
+void sprawdz_calke(const char* nazwa, double lewy, double prawy, int dokl) {
+    if (dokl <= 0)
+        throw std::invalid_argument(std::string(nazwa) + ": liczba podprzedzialow musi byc dodatnia");
+    if (!std::isfinite(lewy) || !std::isfinite(prawy))
+        throw std::invalid_argument(std::string(nazwa) + ": granice musza byc skonczone");
+}
+}
+
+double Wyrazenie::calka_numeryczna(double lewy, double prawy, int dokl) {
+    sprawdz_calke("calka_numeryczna", lewy, prawy, dokl);
+    double h = (prawy - lewy) / dokl;
+    double xs[BLOK], ys[BLOK];
+    double wynik = 0;
+    for (int i = 0; i < dokl; i += BLOK) {
+        int n = std::min<int>(BLOK, dokl - i);
+        for (int j = 0; j < n; ++j) xs[j] = lewy + (i + j + 0.5) * h;
+        oblicz_wartosci(xs, ys, n);
+        for (int j = 0; j < n; ++j) wynik += ys[j];
+    }
+    return wynik * h;
+}
+
+double Wyrazenie::calka_simpson(double lewy, double prawy, int dokl) {
+    sprawdz_calke("calka_simpson", lewy, prawy, dokl);
+    if (dokl % 2) ++dokl;
+    double h = (prawy - lewy) / dokl;
+    double xs[BLOK], ys[BLOK];
+    double wynik = 0;
+    for (int i = 0; i <= dokl; i += BLOK) {
+        int n = std::min<int>(BLOK, dokl + 1 - i);
+        for (int j = 0; j < n; ++j) xs[j] = lewy + (i + j) * h;
+        oblicz_wartosci(xs, ys, n);
+        for (int j = 0; j < n; ++j) {
+            int k = i + j;
+            wynik += ys[j] * (k == 0 || k == dokl ? 1 : (k % 2 ? 4 : 2));
+        }
+    }
+    return wynik * h / 3;
+}
+
+double Wyrazenie::calka_gauss(double lewy, double prawy, int dokl) {
+    sprawdz_calke("calka_gauss", lewy, prawy, dokl);
+    double h = (prawy - lewy) / dokl;
+    double wynik = 0;
+    for (int i = 0; i < dokl; ++i) wynik += gauss_przedzial(this, lewy + i * h, lewy + (i + 1) * h);
+    return wynik;
+}
+
+double Wyrazenie::calka_adaptacyjna(double lewy, double prawy, double tolerancja, unsigned watki) {
+    if (!(tolerancja > 0) || !std::isfinite(tolerancja))
+        throw std::invalid_argument("calka_adaptacyjna: tolerancja musi byc dodatnia");
+    if (!std::isfinite(lewy) || !std::isfinite(prawy))
+        throw std::invalid_argument("calka_adaptacyjna: granice musza byc skonczone");
+    if (watki == 0) watki = std::max(1u, std::thread::hardware_concurrency());
+    // stala liczba kawalkow (wiecej niz watkow, zeby trudne fragmenty nie blokowaly
+    // reszty) - podzial, a wiec i wynik, jest taki sam przy kazdej liczbie watkow
+    const int kawalkow = KAWALKOW_CALKI;
+    watki = std::min<unsigned>(watki, kawalkow);
+    double h = (prawy - lewy) / kawalkow;
+    std::vector<double> wyniki(kawalkow);
+    std::atomic<int> nastepny(0);
+    auto pracuj = [&]() {
+        for (int i; (i = nastepny++) < kawalkow; ) {
+            double a = lewy + i * h, b = lewy + (i + 1) * h;
+            long budzet = BUDZET_CALKI;
+            wyniki[i] = gauss_adaptacyjnie(this, a, b, gauss_przedzial(this, a, b), tolerancja / kawalkow, 30, budzet);
+        }
+    };
+    std::vector<std::thread> pula;
+    for (unsigned t = 1; t < watki; ++t) pula.emplace_back(pracuj);
+    pracuj();
+    for (std::thread& t : pula) t.join();
+    double wynik = 0;
+    for (double w : wyniki) wynik += w; // zawsze w tej samej kolejnosci - wynik nie zalezy od watkow
+    return wynik;
+}
+
 
 class Stala : public Wyrazenie {
     double value;
 public:
     Stala(double _value=0): value(_value) {};
-    ~Stala() = default;
+    double wartosc() const { return value; }
     void wypisz() override {std::cout <<value;}
-    Wyrazenie* kopiuj() override {return new Stala(value);}
-    Wyrazenie* pochodna() override { return new Stala; }
-    double oblicz_wartosc(double x) override { return value; }
+    Wyrazenie* pochodna_wezla(Pochodne&) override;
+    Dualna dualna_wezla(Obliczenie& o) override;
+    void blok_dualny_wezla(Obliczenie& o, double* w, double* d) override;
+    void taylor_wezla(Obliczenie& o, double* c) override;
+    double wartosc_wezla(Obliczenie&) override { return value; }
+    void kompiluj(Program& p) override { p.dodaj(Kod::STALA, value); }
+    void blok_wezla(Obliczenie& o, double* out) override;
+protected:
+    ~Stala() = default;
 };
 
 
+// Zmienna nr indeks (0 - x). Obliczenia jednej zmiennej (oblicz_wartosc, Program,
+// pochodne dualne) traktuja kazda zmienna jako x; oblicz i Tasma rozrozniaja je.
 class Zmienna : public Wyrazenie {
+    int nr;
 public :
-    Zmienna() = default;
+    Zmienna(int indeks = 0) : nr(indeks) {}
+    int indeks() const { return nr; }
+    Wyrazenie* pochodna_wezla(Pochodne& d) override;
+    Dualna dualna_wezla(Obliczenie& o) override;
+    void blok_dualny_wezla(Obliczenie& o, double* w, double* d) override;
+    void taylor_wezla(Obliczenie& o, double* c) override;
+    double wartosc_wezla(Obliczenie& o) override;
+    void wypisz() override { std::cout << "x"; if (nr) std::cout << nr; }
+    void kompiluj(Program& p) override { p.dodaj(Kod::ZMIENNA, 0, nr); }
+    void blok_wezla(Obliczenie& o, double* out) override;
+protected:
     ~Zmienna() = default;
-    Wyrazenie* pochodna() override {return new Stala(1);}
-    double oblicz_wartosc(double x) override {return x;}
-    void wypisz() override {std::cout << "x";}
-    Wyrazenie* kopiuj() override {return new Zmienna();}
 };
 
 
@@ -49,87 +783,780 @@ class Operator : public Wyrazenie {
 protected:
     Wyrazenie* lewy;
     Wyrazenie* prawy;
+    ~Operator() { zwolnij(lewy); zwolnij(prawy); }
 public:
     Operator(Wyrazenie* _lewy, Wyrazenie* _prawy) : lewy(_lewy), prawy(_prawy) {};
-    ~Operator() { delete lewy; delete prawy; }
+    Wyrazenie* lewe() const { return lewy; }
+    Wyrazenie* prawe() const { return prawy; }
     //void wypisz() override {} //decyzja projektowa
+protected:
+    static void wypisz_argument(Wyrazenie* w, bool w_nawiasie) {
+        if (w_nawiasie) std::cout << "(";
+        w->wypisz();
+        if (w_nawiasie) std::cout << ")";
+    }
 };
 
 class Razy : public Operator {
 public:
     Razy(Wyrazenie* _lewy, Wyrazenie* _prawy) : Operator(_lewy, _prawy) {}
+    void wypisz() override;
+    Wyrazenie* pochodna_wezla(Pochodne& d) override;
+    Dualna dualna_wezla(Obliczenie& o) override;
+    void blok_dualny_wezla(Obliczenie& o, double* w, double* d) override;
+    void taylor_wezla(Obliczenie& o, double* c) override;
+    double wartosc_wezla(Obliczenie& o) override;
+    void kompiluj(Program& p) override { p.wezel(lewy); p.wezel(prawy); p.dodaj(Kod::RAZY); }
+    void blok_wezla(Obliczenie& o, double* out) override;
+protected:
     ~Razy() = default;
-    void wypisz() override {
-        lewy->wypisz();
-        std::cout << " * ";
-        prawy->wypisz();
-    };
-    Wyrazenie* pochodna() override;
-    double oblicz_wartosc(double x) override {return lewy->oblicz_wartosc(x) * prawy->oblicz_wartosc(x);};
-    Wyrazenie* kopiuj() override {return new Razy(lewy->kopiuj(), prawy->kopiuj());};
 };
 
 
 class Suma : public Operator {
 public:
     Suma(Wyrazenie* _lewy, Wyrazenie* _prawy) : Operator(_lewy, _prawy) {}
+    void wypisz() override;
+    Wyrazenie* pochodna_wezla(Pochodne& d) override;
+    Dualna dualna_wezla(Obliczenie& o) override;
+    void blok_dualny_wezla(Obliczenie& o, double* w, double* d) override;
+    void taylor_wezla(Obliczenie& o, double* c) override;
+    double wartosc_wezla(Obliczenie& o) override;
+    void kompiluj(Program& p) override { p.wezel(lewy); p.wezel(prawy); p.dodaj(Kod::SUMA); }
+    void blok_wezla(Obliczenie& o, double* out) override;
+protected:
     ~Suma() = default;
-    void wypisz() override {
-        lewy->wypisz();
-        std::cout << " + ";
-        prawy->wypisz();
-    };
-    Wyrazenie* pochodna() override { return new Suma(lewy->pochodna(), prawy->pochodna()); };
-    double oblicz_wartosc(double x) override {
-        return lewy->oblicz_wartosc(x) + prawy->oblicz_wartosc(x);
-    };
-    Wyrazenie* kopiuj() override {return new Suma(lewy->kopiuj(), prawy->kopiuj());};
 };
 
-Wyrazenie* Razy::pochodna() {return new Suma(new Razy(lewy->kopiuj(), prawy->pochodna()), new Razy(lewy->pochodna(), prawy->kopiuj()));};
+// Nawiasy tam, gdzie Parser przeczytalby inne wyrazenie: '*' wiaze mocniej niz '+',
+// a oba lacza w lewo, wiec suma pod iloczynem i prawy argument tego samego
+// dzialania ida w nawiasie
+void Razy::wypisz() {
+    wypisz_argument(lewy, dynamic_cast<Suma*>(lewy) != nullptr);
+    std::cout << " * ";
+    wypisz_argument(prawy, dynamic_cast<Operator*>(prawy) != nullptr);
+}
+
+void Suma::wypisz() {
+    lewy->wypisz();
+    std::cout << " + ";
+    wypisz_argument(prawy, dynamic_cast<Suma*>(prawy) != nullptr);
+}
 
 
 class Funkcja : public Wyrazenie {
 public:
     Funkcja() = delete;
     Funkcja(Wyrazenie* _arg) : arg(_arg) {};
-    ~Funkcja() {delete arg;};
+    Wyrazenie* argument() const { return arg; }
 protected:
     Wyrazenie* arg;
+    ~Funkcja() {zwolnij(arg);};
 };
 
 
 class Cos: public Funkcja{
 public:
     Cos(Wyrazenie* _arg): Funkcja(_arg) {};
-    ~Cos() = default;
-    double oblicz_wartosc(double x) override {return cos(arg->oblicz_wartosc(x));}
-    Wyrazenie* pochodna() override;
-    Wyrazenie* kopiuj() override {return new Cos(arg->kopiuj());};
+    double wartosc_wezla(Obliczenie& o) override;
+    Wyrazenie* pochodna_wezla(Pochodne& d) override;
+    Dualna dualna_wezla(Obliczenie& o) override;
+    void blok_dualny_wezla(Obliczenie& o, double* w, double* d) override;
+    void taylor_wezla(Obliczenie& o, double* c) override;
+    void kompiluj(Program& p) override { p.wezel(arg); p.dodaj(Kod::COS); }
+    void blok_wezla(Obliczenie& o, double* out) override;
     void wypisz() override {
         std::cout << "cos(";
         arg->wypisz();
         std::cout << ")";
     }
+protected:
+    ~Cos() = default;
 };
 
 
 class Sin: public Funkcja {
 public:
     Sin(Wyrazenie* _arg): Funkcja(_arg) {};
-    ~Sin() = default;
-    double oblicz_wartosc(double x) override {return sin(arg->oblicz_wartosc(x));}
-    Wyrazenie* pochodna() override {return new Razy(new Cos(arg->kopiuj()), arg->pochodna());};
-    Wyrazenie* kopiuj() override {return new Sin(arg->kopiuj());};
+    double wartosc_wezla(Obliczenie& o) override;
+    Wyrazenie* pochodna_wezla(Pochodne& d) override;
+    Dualna dualna_wezla(Obliczenie& o) override;
+    void blok_dualny_wezla(Obliczenie& o, double* w, double* d) override;
+    void taylor_wezla(Obliczenie& o, double* c) override;
+    void kompiluj(Program& p) override { p.wezel(arg); p.dodaj(Kod::SIN); }
+    void blok_wezla(Obliczenie& o, double* out) override;
     void wypisz() override {
         std::cout << "sin(";
         arg->wypisz();
         std::cout << ")";
     }
+protected:
+    ~Sin() = default;
+};
+
+
+// Wezly z tablicy wezli - to samo wyrazenie zbudowane drugi raz jest tym samym wezlem.
+// suma, iloczyn, sinus i cosinus od razu upraszczaja wynik: licza stale, usuwaja
+// "+ 0", "* 1", stawiaja stala na lewo i zbieraja wyrazy podobne (2*f + 3*f = 5*f).
+// 0*f nie laczy sie z innymi wyrazami (dla f nieskonczonego daje NaN), a stalych
+// nie przenosimy miedzy nawiasami (a + (c + f) zostaje) - zmieniloby to zaokraglenia
+// i przepelnienia. Wspolne podwyrazenia laczy tablica wezli.
+inline std::uint64_t bity(double v) { std::uint64_t b; std::memcpy(&b, &v, sizeof(b)); return b; }
+Wyrazenie* stala(double v) { return wezel<Stala>({Kod::STALA, bity(v), nullptr, nullptr}, v); }
+Wyrazenie* zmienna(int indeks = 0) {
+    return wezel<Zmienna>({Kod::ZMIENNA, static_cast<std::uint64_t>(indeks), nullptr, nullptr}, indeks);
+}
+
+inline bool jest_stala(Wyrazenie* w, double& v) {
+    Stala* s = dynamic_cast<Stala*>(w);
+    if (s) v = s->wartosc();
+    return s != nullptr;
+}
+
+// Oddaje odwolanie do w, zwracajac nowe do jego czesci
+inline Wyrazenie* zamien(Wyrazenie* w, Wyrazenie* czesc) {
+    czesc->kopiuj();
+    zwolnij(w);
+    return czesc;
+}
+
+// w = c * reszta; reszta to nowe odwolanie
+inline double wspolczynnik(Wyrazenie& w, Wyrazenie*& reszta) {
+    double c;
+    Razy* r = dynamic_cast<Razy*>(&w);
+    if (r && jest_stala(r->lewe(), c)) { reszta = r->prawe()->kopiuj(); return c; }
+    reszta = w.kopiuj();
+    return 1;
+}
+
+Wyrazenie* iloczyn(Wyrazenie* a, Wyrazenie* b);
+
+Wyrazenie* suma(Wyrazenie* a, Wyrazenie* b) {
+    double va, vb;
+    bool sa = jest_stala(a, va), sb = jest_stala(b, vb);
+    if (sa && sb) { zwolnij(a); zwolnij(b); return stala(va + vb); }
+    if (sb) std::swap(a, b), std::swap(va, vb), std::swap(sa, sb); // stala na lewo
+    if (sa && va == 0) { zwolnij(a); return b; }
+    Wyrazenie *ra, *rb;
+    double ca = wspolczynnik(*a, ra), cb = wspolczynnik(*b, rb);
+    if (ra == rb && ca != 0 && cb != 0) { // wyrazy podobne
+        zwolnij(a); zwolnij(b); zwolnij(rb);
+        return iloczyn(stala(ca + cb), ra);
+    }
+    zwolnij(ra); zwolnij(rb);
+    return wezel<Suma>({Kod::SUMA, 0, a, b}, a, b);
+}
+
+Wyrazenie* iloczyn(Wyrazenie* a, Wyrazenie* b) {
+    double va = 0, vb = 0;
+    bool sa = jest_stala(a, va), sb = jest_stala(b, vb);
+    if (sa && sb) { zwolnij(a); zwolnij(b); return stala(va * vb); }
+    if (sb) std::swap(a, b), std::swap(va, vb), std::swap(sa, sb);
+    // 0 * f zostaje: dla f nieskonczonego albo NaN wynik to NaN, nie 0
+    if (sa && va == 1) { zwolnij(a); return b; }
+    return wezel<Razy>({Kod::RAZY, 0, a, b}, a, b);
+}
+
+Wyrazenie* sinus(Wyrazenie* a) {
+    double v;
+    if (jest_stala(a, v)) { zwolnij(a); return stala(sin(v)); }
+    return wezel<Sin>({Kod::SIN, 0, a, nullptr}, a);
+}
+
+Wyrazenie* cosinus(Wyrazenie* a) {
+    double v;
+    if (jest_stala(a, v)) { zwolnij(a); return stala(cos(v)); }
+    return wezel<Cos>({Kod::COS, 0, a, nullptr}, a);
+}
+
+// Uproszczona wersja dowolnego wyrazenia (np. zbudowanego przez new) - nowe odwolanie
+Wyrazenie* uprosc(Wyrazenie* w, std::unordered_map<Wyrazenie*, Wyrazenie*>& gotowe) {
+    auto it = gotowe.find(w);
+    if (it != gotowe.end()) return it->second->kopiuj();
+    Wyrazenie* wynik;
+    double v;
+    if (jest_stala(w, v)) wynik = stala(v);
+    else if (Suma* s = dynamic_cast<Suma*>(w)) wynik = suma(uprosc(s->lewe(), gotowe), uprosc(s->prawe(), gotowe));
+    else if (Razy* r = dynamic_cast<Razy*>(w)) wynik = iloczyn(uprosc(r->lewe(), gotowe), uprosc(r->prawe(), gotowe));
+    else if (Sin* f = dynamic_cast<Sin*>(w)) wynik = sinus(uprosc(f->argument(), gotowe));
+    else if (Cos* f = dynamic_cast<Cos*>(w)) wynik = cosinus(uprosc(f->argument(), gotowe));
+    else wynik = zmienna(dynamic_cast<Zmienna*>(w)->indeks());
+    gotowe.emplace(w, wynik);
+    return wynik->kopiuj();
+}
+
+Wyrazenie* uprosc(Wyrazenie* w) {
+    std::unordered_map<Wyrazenie*, Wyrazenie*> gotowe;
+    Wyrazenie* wynik = uprosc(w, gotowe);
+    for (auto& p : gotowe) zwolnij(p.second);
+    return wynik;
+}
+
+// Pochodne uzywaja istniejacych wezlow (kopiuj) zamiast kopiowac poddrzewa.
+// Czynnik o pochodnej rownej stalej 0 nie daje wyrazu - nie mnozymy go przez 0,
+// bo iloczyn nie skraca 0 * f.
+inline bool zero(Wyrazenie* w) {
+    double v;
+    return jest_stala(w, v) && v == 0;
+}
+
+Wyrazenie* Stala::pochodna_wezla(Pochodne&)     { return stala(0); }
+Wyrazenie* Zmienna::pochodna_wezla(Pochodne& d) { return stala(nr == d.zmienna ? 1 : 0); }
+Wyrazenie* Suma::pochodna_wezla(Pochodne& d)    { return suma(d(lewy), d(prawy)); }
+Wyrazenie* Razy::pochodna_wezla(Pochodne& d) {
+    Wyrazenie *dl = d(lewy), *dp = d(prawy);
+    if (zero(dl)) { zwolnij(dl); return zero(dp) ? dp : iloczyn(lewy->kopiuj(), dp); }
+    if (zero(dp)) { zwolnij(dp); return iloczyn(dl, prawy->kopiuj()); }
+    return suma(iloczyn(lewy->kopiuj(), dp), iloczyn(dl, prawy->kopiuj()));
+}
+Wyrazenie* Sin::pochodna_wezla(Pochodne& d) {
+    Wyrazenie* da = d(arg);
+    return zero(da) ? da : iloczyn(cosinus(arg->kopiuj()), da);
+}
+Wyrazenie* Cos::pochodna_wezla(Pochodne& d) {
+    Wyrazenie* da = d(arg);
+    return zero(da) ? da : iloczyn(stala(-1), iloczyn(sinus(arg->kopiuj()), da));
+}
+
+
+// Rozniczkowanie w przod. Szeregi Taylora (c[k] = f^(k)/k!): iloczyn to splot
+// wspolczynnikow, a sin/cos argumentu u spelniaja s' = c u', c' = -s u',
+// co daje s_k = 1/k sum j u_j c_{k-j}, c_k = -1/k sum j u_j s_{k-j}.
+double Zmienna::wartosc_wezla(Obliczenie& o) { return o.zmienne ? o.zmienne[nr] : o.x; }
+double Suma::wartosc_wezla(Obliczenie& o)    { return o.wartosc(lewy) + o.wartosc(prawy); }
+double Razy::wartosc_wezla(Obliczenie& o)    { return o.wartosc(lewy) * o.wartosc(prawy); }
+double Sin::wartosc_wezla(Obliczenie& o)     { return sin(o.wartosc(arg)); }
+double Cos::wartosc_wezla(Obliczenie& o)     { return cos(o.wartosc(arg)); }
+
+void Stala::blok_wezla(Obliczenie& o, double* out)   { std::fill(out, out + o.n, value); }
+void Zmienna::blok_wezla(Obliczenie& o, double* out) { std::copy(o.xs, o.xs + o.n, out); }
+void Suma::blok_wezla(Obliczenie& o, double* out) {
+    double tmp[BLOK];
+    o.blok(lewy, out);
+    o.blok(prawy, tmp);
+    for (std::size_t i = 0; i < o.n; ++i) out[i] += tmp[i];
+}
+void Razy::blok_wezla(Obliczenie& o, double* out) {
+    double tmp[BLOK];
+    o.blok(lewy, out);
+    o.blok(prawy, tmp);
+    for (std::size_t i = 0; i < o.n; ++i) out[i] *= tmp[i];
+}
+void Sin::blok_wezla(Obliczenie& o, double* out) {
+    o.blok(arg, out);
+    sin_cos_blok(out, out, o.n, false);
+}
+void Cos::blok_wezla(Obliczenie& o, double* out) {
+    o.blok(arg, out);
+    sin_cos_blok(out, out, o.n, true);
+}
+
+Dualna Stala::dualna_wezla(Obliczenie&)     { return {value, 0}; }
+Dualna Zmienna::dualna_wezla(Obliczenie& o) { return {o.x, 1}; }
+Dualna Suma::dualna_wezla(Obliczenie& o) {
+    Dualna a = o.dualna(lewy), b = o.dualna(prawy);
+    return {a.w + b.w, a.d + b.d};
+}
+Dualna Razy::dualna_wezla(Obliczenie& o) {
+    Dualna a = o.dualna(lewy), b = o.dualna(prawy);
+    return {a.w * b.w, a.d * b.w + a.w * b.d};
+}
+Dualna Sin::dualna_wezla(Obliczenie& o) {
+    Dualna u = o.dualna(arg);
+    return {sin(u.w), cos(u.w) * u.d};
+}
+Dualna Cos::dualna_wezla(Obliczenie& o) {
+    Dualna u = o.dualna(arg);
+    return {cos(u.w), -sin(u.w) * u.d};
+}
+
+void Stala::blok_dualny_wezla(Obliczenie& o, double* w, double* d) {
+    std::fill(w, w + o.n, value);
+    std::fill(d, d + o.n, 0.0);
+}
+void Zmienna::blok_dualny_wezla(Obliczenie& o, double* w, double* d) {
+    std::copy(o.xs, o.xs + o.n, w);
+    std::fill(d, d + o.n, 1.0);
+}
+void Suma::blok_dualny_wezla(Obliczenie& o, double* w, double* d) {
+    double w2[BLOK], d2[BLOK];
+    o.blok_dualny(lewy, w, d);
+    o.blok_dualny(prawy, w2, d2);
+    for (std::size_t i = 0; i < o.n; ++i) { w[i] += w2[i]; d[i] += d2[i]; }
+}
+void Razy::blok_dualny_wezla(Obliczenie& o, double* w, double* d) {
+    double w2[BLOK], d2[BLOK];
+    o.blok_dualny(lewy, w, d);
+    o.blok_dualny(prawy, w2, d2);
+    for (std::size_t i = 0; i < o.n; ++i) { d[i] = d[i] * w2[i] + w[i] * d2[i]; w[i] *= w2[i]; }
+}
+void Sin::blok_dualny_wezla(Obliczenie& o, double* w, double* d) {
+    double c[BLOK];
+    o.blok_dualny(arg, w, d);
+    sin_cos_blok(w, c, o.n, true);
+    sin_cos_blok(w, w, o.n, false);
+    for (std::size_t i = 0; i < o.n; ++i) d[i] *= c[i];
+}
+void Cos::blok_dualny_wezla(Obliczenie& o, double* w, double* d) {
+    double s[BLOK];
+    o.blok_dualny(arg, w, d);
+    sin_cos_blok(w, s, o.n, false);
+    sin_cos_blok(w, w, o.n, true);
+    for (std::size_t i = 0; i < o.n; ++i) d[i] *= -s[i];
+}
+
+void Stala::taylor_wezla(Obliczenie& o, double* c) {
+    std::fill(c, c + o.rzad + 1, 0.0);
+    c[0] = value;
+}
+void Zmienna::taylor_wezla(Obliczenie& o, double* c) {
+    std::fill(c, c + o.rzad + 1, 0.0);
+    c[0] = o.x;
+    if (o.rzad > 0) c[1] = 1;
+}
+void Suma::taylor_wezla(Obliczenie& o, double* c) {
+    double b[MAX_RZAD + 1];
+    o.taylor(lewy, c);
+    o.taylor(prawy, b);
+    for (int k = 0; k <= o.rzad; ++k) c[k] += b[k];
+}
+void Razy::taylor_wezla(Obliczenie& o, double* c) {
+    double a[MAX_RZAD + 1], b[MAX_RZAD + 1];
+    o.taylor(lewy, a);
+    o.taylor(prawy, b);
+    for (int k = 0; k <= o.rzad; ++k) {
+        c[k] = 0;
+        for (int i = 0; i <= k; ++i) c[k] += a[i] * b[k - i];
+    }
+}
+// s - wspolczynniki sin(u), c - cos(u)
+inline void sin_cos_taylor(const double* u, double* s, double* c, int rzad) {
+    s[0] = sin(u[0]);
+    c[0] = cos(u[0]);
+    for (int k = 1; k <= rzad; ++k) {
+        double ss = 0, cc = 0;
+        for (int j = 1; j <= k; ++j) { ss += j * u[j] * c[k - j]; cc += j * u[j] * s[k - j]; }
+        s[k] = ss / k;
+        c[k] = -cc / k;
+    }
+}
+void Sin::taylor_wezla(Obliczenie& o, double* c) {
+    double u[MAX_RZAD + 1], drugie[MAX_RZAD + 1];
+    o.taylor(arg, u);
+    sin_cos_taylor(u, c, drugie, o.rzad);
+}
+void Cos::taylor_wezla(Obliczenie& o, double* c) {
+    double u[MAX_RZAD + 1], drugie[MAX_RZAD + 1];
+    o.taylor(arg, u);
+    sin_cos_taylor(u, drugie, c, o.rzad);
+}
+
+// Wyrazenie wielu zmiennych jako lista wezlow w kolejnosci obliczania (dzieci przed
+// rodzicami, wspoldzielony wezel raz). Wartosc liczymy jednym przejsciem w przod,
+// a caly gradient jednym przejsciem wstecz (rozniczkowanie wstecz) po tej samej liscie.
+// Tablice robocze sa w obiekcie - jedna Tasma nie moze liczyc w kilku watkach naraz.
+class Tasma {
+    struct Wezel {
+        Kod kod;
+        int a, b;     // numery dzieci; dla ZMIENNA a = numer zmiennej
+        double stala;
+    };
+    std::vector<Wezel> wezly;
+    std::vector<double> wartosci, sprzezone;
+    int zmiennych = 0;
+
+    void w_przod(const double* z) {
+        for (std::size_t i = 0; i < wezly.size(); ++i) {
+            const Wezel& w = wezly[i];
+            switch (w.kod) {
+            case Kod::STALA:   wartosci[i] = w.stala; break;
+            case Kod::ZMIENNA: wartosci[i] = z[w.a]; break;
+            case Kod::SUMA:    wartosci[i] = wartosci[w.a] + wartosci[w.b]; break;
+            case Kod::RAZY:    wartosci[i] = wartosci[w.a] * wartosci[w.b]; break;
+            case Kod::SIN:     wartosci[i] = sin(wartosci[w.a]); break;
+            case Kod::COS:     wartosci[i] = cos(wartosci[w.a]); break;
+            default: break;
+            }
+        }
+    }
+
+public:
+    explicit Tasma(Wyrazenie* wyr) {
+        // przechodzimy program postfiksowy, trzymajac na stosie numery wezlow
+        Program p = wyr->skompiluj();
+        std::vector<int> stos, komorki(p.liczba_komorek());
+        for (const Instrukcja& in : p.kod()) {
+            int n = static_cast<int>(wezly.size());
+            switch (in.kod) {
+            case Kod::STALA:   wezly.push_back({in.kod, 0, 0, in.stala}); stos.push_back(n); break;
+            case Kod::ZMIENNA:
+                wezly.push_back({in.kod, in.komorka, 0, 0});
+                zmiennych = std::max(zmiennych, in.komorka + 1);
+                stos.push_back(n);
+                break;
+            case Kod::SUMA:
+            case Kod::RAZY: {
+                int b = stos.back(); stos.pop_back();
+                int a = stos.back();
+                wezly.push_back({in.kod, a, b, 0});
+                stos.back() = n;
+                break;
+            }
+            case Kod::SIN:
+            case Kod::COS:     wezly.push_back({in.kod, stos.back(), 0, 0}); stos.back() = n; break;
+            case Kod::ZAPISZ:  komorki[in.komorka] = stos.back(); break;
+            case Kod::WCZYTAJ: stos.push_back(komorki[in.komorka]); break;
+            }
+        }
+        wartosci.resize(wezly.size());
+        sprzezone.resize(wezly.size());
+    }
+
+    int liczba_zmiennych() const { return zmiennych; }
+
+    double oblicz(const double* zmienne) {
+        w_przod(zmienne);
+        return wartosci.back();
+    }
+
+    // gradient[i] = pochodna po zmiennej nr i (i < liczba_zmiennych); zwraca wartosc
+    double gradient(const double* zmienne, double* gradient) {
+        w_przod(zmienne);
+        std::fill(gradient, gradient + zmiennych, 0.0);
+        std::fill(sprzezone.begin(), sprzezone.end(), 0.0);
+        sprzezone.back() = 1;
+        for (std::size_t i = wezly.size(); i-- > 0; ) {
+            const Wezel& w = wezly[i];
+            double g = sprzezone[i];
+            switch (w.kod) {
+            case Kod::ZMIENNA: gradient[w.a] += g; break;
+            case Kod::SUMA:    sprzezone[w.a] += g; sprzezone[w.b] += g; break;
+            case Kod::RAZY:
+                sprzezone[w.a] += g * wartosci[w.b];
+                sprzezone[w.b] += g * wartosci[w.a];
+                break;
+            case Kod::SIN:     sprzezone[w.a] += g * cos(wartosci[w.a]); break;
+            case Kod::COS:     sprzezone[w.a] -= g * sin(wartosci[w.a]); break;
+            default: break;
+            }
+        }
+        return wartosci.back();
+    }
+
+    // Wiele punktow naraz: macierz[wiersz * liczba_zmiennych + i], gradienty w tym samym ukladzie
+    void gradient_wiele(const double* macierz, std::size_t wierszy, double* wyniki, double* gradienty) {
+        for (std::size_t r = 0; r < wierszy; ++r)
+            wyniki[r] = gradient(macierz + r * zmiennych, gradienty + r * zmiennych);
+    }
 };
 
-Wyrazenie* Cos::pochodna() {return new Razy(new Stala(-1), new Razy(new Sin(arg->kopiuj()), arg->pochodna()));};
+// Parser skladni wypisywanej przez wypisz(): +, *, sin(...), cos(...), nawiasy,
+// liczby (tez ujemne) i zmienne x, x1, x2, ... '*' wiaze mocniej niz '+', oba
+// lacza w lewo. Wezly powstaja przez funkcje z tablicy wezli (wiec od razu sa
+// uproszczone i wspoldzielone). Liczby to cyfry z opcjonalna kropka i wykladnikiem
+// (bez inf/nan), nawiasy i funkcje zagniezdzaja sie najwyzej MAX_ZAGLEBIENIE razy.
+// Blad skladni - nullptr.
+class Parser {
+    static constexpr int MAX_ZAGLEBIENIE = 256;
+    const char* p;
+    const char* koniec;
+    bool blad = false;
+    int zaglebienie = 0;
 
+    void spacje() { while (p < koniec && (*p == ' ' || *p == '\t' || *p == '\n')) ++p; }
+    bool znak(char c) {
+        spacje();
+        if (p < koniec && *p == c) { ++p; return true; }
+        return false;
+    }
+    bool slowo(const char* s, std::size_t n) {
+        spacje();
+        if (static_cast<std::size_t>(koniec - p) >= n && std::memcmp(p, s, n) == 0) { p += n; return true; }
+        return false;
+    }
+    Wyrazenie* porazka(Wyrazenie* w) { zwolnij(w); blad = true; return nullptr; }
+
+    Wyrazenie* suma_() {
+        Wyrazenie* w = iloczyn_();
+        while (w && znak('+')) {
+            Wyrazenie* b = iloczyn_();
+            if (!b) return porazka(w);
+            w = suma(w, b);
+        }
+        return w;
+    }
+    Wyrazenie* iloczyn_() {
+        Wyrazenie* w = czynnik();
+        while (w && znak('*')) {
+            Wyrazenie* b = czynnik();
+            if (!b) return porazka(w);
+            w = iloczyn(w, b);
+        }
+        return w;
+    }
+    Wyrazenie* funkcja(bool cosinus_) {
+        if (!znak('(')) return porazka(nullptr);
+        Wyrazenie* a = suma_();
+        if (!a || !znak(')')) return porazka(a);
+        return cosinus_ ? cosinus(a) : sinus(a);
+    }
+    static bool cyfra(char c) { return c >= '0' && c <= '9'; }
+    // Kazde zejscie w glab (nawias, funkcja, minus) przechodzi przez czynnik
+    Wyrazenie* czynnik() {
+        if (zaglebienie == MAX_ZAGLEBIENIE) return porazka(nullptr);
+        ++zaglebienie;
+        Wyrazenie* w = czynnik_();
+        --zaglebienie;
+        return w;
+    }
+    Wyrazenie* czynnik_() {
+        spacje();
+        if (p == koniec) return porazka(nullptr);
+        if (slowo("sin", 3)) return funkcja(false);
+        if (slowo("cos", 3)) return funkcja(true);
+        if (*p == 'x') {
+            ++p;
+            int nr = 0;
+            if (p < koniec && cyfra(*p)) {
+                auto wynik = std::from_chars(p, koniec, nr);
+                if (wynik.ec != std::errc()) return porazka(nullptr); // numer poza zakresem int
+                p = wynik.ptr;
+            }
+            return zmienna(nr);
+        }
+        if (znak('(')) {
+            Wyrazenie* w = suma_();
+            if (!w || !znak(')')) return porazka(w);
+            return w;
+        }
+        // from_chars przyjalby tez inf i nan - liczba musi zaczynac sie cyfra albo kropka
+        const char* q = p + (*p == '-');
+        if (q < koniec && (cyfra(*q) || (*q == '.' && q + 1 < koniec && cyfra(q[1])))) {
+            double v;
+            auto wynik = std::from_chars(p, koniec, v);
+            if (wynik.ec != std::errc()) return porazka(nullptr); // np. 1e999
+            p = wynik.ptr;
+            return stala(v);
+        }
+        if (znak('-')) { // minus przed czymkolwiek innym niz liczba
+            Wyrazenie* w = czynnik();
+            return w ? iloczyn(stala(-1), w) : porazka(nullptr);
+        }
+        return porazka(nullptr);
+    }
+
+public:
+    static Wyrazenie* parsuj(std::string_view tekst) {
+        Parser ps;
+        ps.p = tekst.data();
+        ps.koniec = tekst.data() + tekst.size();
+        Wyrazenie* w = ps.suma_();
+        ps.spacje();
+        if (!w || ps.blad || ps.p != ps.koniec) { zwolnij(w); return nullptr; }
+        return w;
+    }
+};
+
+inline Wyrazenie* parsuj(std::string_view tekst) { return Parser::parsuj(tekst); }
+
+// Ostatnio uzywane wzory (LRU): powtorzony tekst nie jest parsowany ponownie.
+// pobierz zwraca nowe odwolanie (albo nullptr dla blednego wzoru).
+class PamiecWzorow {
+    typedef std::list<std::pair<std::string, Wyrazenie*>> Lista;
+    std::size_t pojemnosc;
+    Lista lista; // od ostatnio uzytego
+    std::unordered_map<std::string_view, Lista::iterator> indeks; // klucze wskazuja na napisy z listy
+public:
+    explicit PamiecWzorow(std::size_t _pojemnosc = 1024) : pojemnosc(std::max<std::size_t>(1, _pojemnosc)) {}
+    PamiecWzorow(const PamiecWzorow&) = delete;
+    PamiecWzorow& operator=(const PamiecWzorow&) = delete;
+    ~PamiecWzorow() { for (auto& e : lista) zwolnij(e.second); }
+
+    Wyrazenie* pobierz(std::string_view tekst) {
+        auto it = indeks.find(tekst);
+        if (it != indeks.end()) {
+            lista.splice(lista.begin(), lista, it->second);
+            return it->second->second->kopiuj();
+        }
+        Wyrazenie* w = parsuj(tekst);
+        if (!w) return nullptr;
+        if (lista.size() == pojemnosc) {
+            indeks.erase(lista.back().first);
+            zwolnij(lista.back().second);
+            lista.pop_back();
+        }
+        lista.emplace_front(std::string(tekst), w);
+        indeks.emplace(lista.front().first, lista.begin());
+        return w->kopiuj();
+    }
+    std::size_t rozmiar() const { return lista.size(); }
+};
+
+// Wyrazenia znane w czasie kompilacji: te same wezly co wyzej, ale jako typy.
+// Cale wyrazenie (i jego pochodna - tez liczona przez kompilator) jest jednym
+// obiektem bez wskaznikow, wiec oblicz_wartosc rozwija sie w prosty ciag dzialan.
+// Zero i Jeden pozwalaja uproscic pochodna juz na poziomie typow.
+// do_wyrazenia() buduje odpowiadajace wyrazenie z tablicy wezli (nowe odwolanie).
+namespace statyczne {
+
+template<class T> struct jest_statyczne : std::false_type {};
+
+struct Zero {
+    constexpr double oblicz_wartosc(double) const { return 0; }
+    constexpr Zero pochodna() const { return {}; }
+    Wyrazenie* do_wyrazenia() const { return stala(0); }
+};
+
+struct Jeden {
+    constexpr double oblicz_wartosc(double) const { return 1; }
+    constexpr Zero pochodna() const { return {}; }
+    Wyrazenie* do_wyrazenia() const { return stala(1); }
+};
+
+struct Stala {
+    double value;
+    constexpr double oblicz_wartosc(double) const { return value; }
+    constexpr Zero pochodna() const { return {}; }
+    Wyrazenie* do_wyrazenia() const { return stala(value); }
+};
+
+struct Zmienna {
+    constexpr double oblicz_wartosc(double x) const { return x; }
+    constexpr Jeden pochodna() const { return {}; }
+    Wyrazenie* do_wyrazenia() const { return zmienna(); }
+};
+
+template<class L, class P> struct Suma;
+template<class L, class P> struct Razy;
+template<class A> struct Sin;
+template<class A> struct Cos;
+
+template<class A, class B>
+constexpr auto dodaj(A a, B b) {
+    if constexpr (std::is_same<A, Zero>::value) return b;
+    else if constexpr (std::is_same<B, Zero>::value) return a;
+    else return Suma<A, B>{a, b};
+}
+
+template<class A, class B>
+constexpr auto pomnoz(A a, B b) {
+    if constexpr (std::is_same<A, Zero>::value || std::is_same<B, Zero>::value) return Zero{};
+    else if constexpr (std::is_same<A, Jeden>::value) return b;
+    else if constexpr (std::is_same<B, Jeden>::value) return a;
+    else return Razy<A, B>{a, b};
+}
+
+template<class L, class P>
+struct Suma {
+    L lewy;
+    P prawy;
+    constexpr double oblicz_wartosc(double x) const { return lewy.oblicz_wartosc(x) + prawy.oblicz_wartosc(x); }
+    constexpr auto pochodna() const { return dodaj(lewy.pochodna(), prawy.pochodna()); }
+    Wyrazenie* do_wyrazenia() const { return suma(lewy.do_wyrazenia(), prawy.do_wyrazenia()); }
+};
+
+template<class L, class P>
+struct Razy {
+    L lewy;
+    P prawy;
+    constexpr double oblicz_wartosc(double x) const { return lewy.oblicz_wartosc(x) * prawy.oblicz_wartosc(x); }
+    constexpr auto pochodna() const { return dodaj(pomnoz(lewy, prawy.pochodna()), pomnoz(lewy.pochodna(), prawy)); }
+    Wyrazenie* do_wyrazenia() const { return iloczyn(lewy.do_wyrazenia(), prawy.do_wyrazenia()); }
+};
+
+template<class A>
+struct Sin {
+    A arg;
+    double oblicz_wartosc(double x) const { return std::sin(arg.oblicz_wartosc(x)); }
+    constexpr auto pochodna() const { return pomnoz(Cos<A>{arg}, arg.pochodna()); }
+    Wyrazenie* do_wyrazenia() const { return sinus(arg.do_wyrazenia()); }
+};
+
+template<class A>
+struct Cos {
+    A arg;
+    double oblicz_wartosc(double x) const { return std::cos(arg.oblicz_wartosc(x)); }
+    constexpr auto pochodna() const { return pomnoz(Stala{-1}, pomnoz(Sin<A>{arg}, arg.pochodna())); }
+    Wyrazenie* do_wyrazenia() const { return cosinus(arg.do_wyrazenia()); }
+};
+
+template<> struct jest_statyczne<Zero> : std::true_type {};
+template<> struct jest_statyczne<Jeden> : std::true_type {};
+template<> struct jest_statyczne<Stala> : std::true_type {};
+template<> struct jest_statyczne<Zmienna> : std::true_type {};
+template<class L, class P> struct jest_statyczne<Suma<L, P>> : std::true_type {};
+template<class L, class P> struct jest_statyczne<Razy<L, P>> : std::true_type {};
+template<class A> struct jest_statyczne<Sin<A>> : std::true_type {};
+template<class A> struct jest_statyczne<Cos<A>> : std::true_type {};
+
+// Skladnia: x * x + 2.0 * sin(x)
+template<class T> constexpr auto jako_wyrazenie(T t) {
+    if constexpr (std::is_arithmetic<T>::value) return Stala{static_cast<double>(t)};
+    else return t;
+}
+
+template<class A, class B>
+using gdy_statyczne = std::enable_if_t<(jest_statyczne<A>::value || jest_statyczne<B>::value)
+                                       && (jest_statyczne<A>::value || std::is_arithmetic<A>::value)
+                                       && (jest_statyczne<B>::value || std::is_arithmetic<B>::value)>;
+
+template<class A, class B, class = gdy_statyczne<A, B>>
+constexpr auto operator+(A a, B b) { return Suma<decltype(jako_wyrazenie(a)), decltype(jako_wyrazenie(b))>{jako_wyrazenie(a), jako_wyrazenie(b)}; }
+
+template<class A, class B, class = gdy_statyczne<A, B>>
+constexpr auto operator*(A a, B b) { return Razy<decltype(jako_wyrazenie(a)), decltype(jako_wyrazenie(b))>{jako_wyrazenie(a), jako_wyrazenie(b)}; }
+
+template<class A, class = std::enable_if_t<jest_statyczne<A>::value>>
+constexpr Sin<A> sin(A a) { return {a}; }
+
+template<class A, class = std::enable_if_t<jest_statyczne<A>::value>>
+constexpr Cos<A> cos(A a) { return {a}; }
+
+}
+
+
+// Tekst, ktory wypisz() daje dla w
+std::string wypisane(Wyrazenie* w) {
+    std::ostringstream napis;
+    std::streambuf* cout_bufor = std::cout.rdbuf(napis.rdbuf());
+    w->wypisz();
+    std::cout.rdbuf(cout_bufor);
+    return napis.str();
+}
+
+// Parser czyta z powrotem to, co wypisal wypisz() - dzieki tablicy wezli to samo
+// wyrazenie jest tym samym wezlem, wiec wystarczy porownac wskazniki.
+// Stale w przykladach maja krotki zapis dziesietny (wypisz() daje 6 cyfr).
+bool sprawdz_wypisz(std::ostream& wyjscie) {
+    Wyrazenie* x = zmienna(0);
+    Wyrazenie* x1 = zmienna(1);
+    Wyrazenie* f = iloczyn(sinus(iloczyn(x->kopiuj(), x->kopiuj())), suma(x->kopiuj(), stala(0.5)));
+    Wyrazenie* przyklady[] = {
+        iloczyn(x->kopiuj(), suma(stala(2), x->kopiuj())),
+        iloczyn(suma(x->kopiuj(), x1->kopiuj()), suma(x->kopiuj(), stala(3))),
+        suma(x->kopiuj(), suma(x1->kopiuj(), zmienna(2))),
+        iloczyn(x->kopiuj(), iloczyn(x1->kopiuj(), sinus(x->kopiuj()))),
+        suma(cosinus(iloczyn(x->kopiuj(), suma(x->kopiuj(), stala(1)))), iloczyn(stala(-3), x1->kopiuj())),
+        f->kopiuj(),
+        f->pochodna(),
+    };
+    bool zgodne = true;
+    for (Wyrazenie* w : przyklady) {
+        std::string tekst = wypisane(w);
+        Wyrazenie* przeczytane = Parser::parsuj(tekst);
+        if (przeczytane != w) {
+            wyjscie << "wypisz -> Parser: inne wyrazenie dla " << tekst << "\n";
+            zgodne = false;
+        }
+        zwolnij(przeczytane);
+    }
+    for (Wyrazenie* w : przyklady) zwolnij(w);
+    zwolnij(f);
+    zwolnij(x);
+    zwolnij(x1);
+    if (zgodne) wyjscie << "wypisz -> Parser: zgodne\n";
+    return zgodne;
+}
 
 int main() {
     Wyrazenie* w1 = new Sin(new Zmienna());
@@ -137,4 +1564,26 @@ int main() {
     Wyrazenie* w2 = w1->pochodna();
     std::cout <<"\n";
     w2->wypisz();
+    Program p2 = w2->skompiluj();
+    std::cout << "\n" << w2->oblicz_wartosc(0.5) << " = " << p2.oblicz(0.5) << "\n";
+    Dualna fd = w1->oblicz_z_pochodna(0.5);
+    std::cout << "dualnie: " << fd.w << ", " << fd.d << "\n";
+    ProgramNatywny n2(p2);
+    std::cout << "natywnie: " << n2.oblicz(0.5) << "\n";
+    constexpr statyczne::Zmienna x;
+    auto f = sin(x * x) + 2.0 * x;
+    auto df = f.pochodna();
+    Wyrazenie* wdf = df.do_wyrazenia();
+    std::cout << "statycznie: " << df.oblicz_wartosc(0.5) << " = " << wdf->oblicz_wartosc(0.5) << " dla ";
+    wdf->wypisz();
+    std::cout << "\n";
+    zwolnij(wdf);
+    PamiecWzorow wzory;
+    Wyrazenie* wp = wzory.pobierz("sin(x * x) + 2 * cos(x1)");
+    wp->wypisz();
+    std::cout << "\n";
+    zwolnij(wp);
+    std::cout << "calka sin(x) na [0, pi]: " << w1->calka_adaptacyjna(0, M_PI, 1e-12) << "\n";
+    bool wypisz_zgodne = sprawdz_wypisz(std::cout);
+    return wypisz_zgodne ? 0 : 1;
 }
\ No newline at end of file
@@ -1,20 +1,436 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <deque>
+#include <map>
+#include <iterator>
+#include <unordered_map>
 #include <random>
+#include <atomic>
+#include <thread>
+#include <tuple>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <memory>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <charconv>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GIELDA_SIMD
+#include <immintrin.h>
+#endif
+
+// -----------------------------------------------------------
+//   Klasa TablicaSymboli (internowanie nazw)
+// -----------------------------------------------------------
+// Każda nazwa jest przechowywana dokładnie raz, a na zewnątrz
+// posługujemy się małym identyfikatorem (indeks nazwy w tablicy).
+class TablicaSymboli {
+public:
+    static const int BRAK = -1;
+
+    TablicaSymboli() = default;
+    TablicaSymboli(const TablicaSymboli&) = delete;
+    TablicaSymboli& operator=(const TablicaSymboli&) = delete;
+
+    // Zwraca id nazwy, w razie potrzeby dopisując ją do tablicy
+    int internuj(std::string_view nazwa) {
+        auto it = m_indeks.find(nazwa);
+        if (it != m_indeks.end()) {
+            return it->second;
+        }
+        int id = static_cast<int>(m_nazwy.size());
+        m_nazwy.emplace_back(nazwa);
+        m_indeks.emplace(std::string_view(m_nazwy.back()), id);
+        return id;
+    }
+
+    // Tylko wyszukuje - dla nieznanej nazwy zwraca BRAK
+    int znajdz(std::string_view nazwa) const {
+        auto it = m_indeks.find(nazwa);
+        return it == m_indeks.end() ? BRAK : it->second;
+    }
+
+    const std::string& nazwa(int id) const { return m_nazwy[id]; }
+    std::size_t rozmiar() const            { return m_nazwy.size(); }
+
+    // Napisy zostają w swoich blokach deque, więc klucze indeksu nadal są ważne
+    void zamien(TablicaSymboli& inna) {
+        m_nazwy.swap(inna.m_nazwy);
+        m_indeks.swap(inna.m_indeks);
+    }
+
+private:
+    // deque nie przenosi elementów przy dopisywaniu, więc klucze
+    // (string_view na napisy z m_nazwy) pozostają ważne
+    std::deque<std::string>                   m_nazwy;
+    std::unordered_map<std::string_view, int> m_indeks;
+};
+
+// -----------------------------------------------------------
+//   Szablon PulaObiektow (alokacja blokami)
+// -----------------------------------------------------------
+// Obiekty jednego typu trzymane w blokach (slabach) po NaSlab sztuk.
+// Adresy obiektów nie zmieniają się do końca życia puli, kolejne obiekty
+// leżą obok siebie w pamięci, a zwolnienie puli to zwolnienie bloków
+// (destruktory wołamy tylko dla typów, które ich wymagają).
+template<typename T, std::size_t NaSlab = 256>
+class PulaObiektow {
+public:
+    PulaObiektow() : m_rozmiar(0) {}
+
+    PulaObiektow(const PulaObiektow&) = delete;
+    PulaObiektow& operator=(const PulaObiektow&) = delete;
+
+    ~PulaObiektow() {
+        if (!std::is_trivially_destructible<T>::value) {
+            for (std::size_t i = 0; i < m_rozmiar; i++) {
+                (*this)[i].~T();
+            }
+        }
+        for (std::size_t i = 0; i < m_slaby.size(); i++) {
+            ::operator delete(m_slaby[i]);
+        }
+    }
+
+    template<typename... Argumenty>
+    T* utworz(Argumenty&&... argumenty) {
+        if (m_rozmiar == m_slaby.size() * NaSlab) {
+            m_slaby.push_back(static_cast<T*>(::operator new(sizeof(T) * NaSlab)));
+        }
+        T* miejsce = m_slaby.back() + m_rozmiar % NaSlab;
+        T* nowy = new (miejsce) T(std::forward<Argumenty>(argumenty)...);
+        m_rozmiar++;
+        return nowy;
+    }
+
+    // Obiekty w kolejności tworzenia
+    T& operator[](std::size_t i)             { return m_slaby[i / NaSlab][i % NaSlab]; }
+    const T& operator[](std::size_t i) const { return m_slaby[i / NaSlab][i % NaSlab]; }
+    std::size_t rozmiar() const              { return m_rozmiar; }
+
+    // Zamienia zawartość - obiekty nie zmieniają adresów
+    void zamien(PulaObiektow& inna) {
+        m_slaby.swap(inna.m_slaby);
+        std::swap(m_rozmiar, inna.m_rozmiar);
+    }
+
+private:
+    std::vector<T*> m_slaby;
+    std::size_t     m_rozmiar;
+};
+
+// -----------------------------------------------------------
+//   Wyszukiwanie ceny w kolumnach (argmin / argmax)
+// -----------------------------------------------------------
+// Zwracają indeks najlepszej ceny wśród wierszy z > 0 sztuk i towarem
+// idTowaru (idTowaru < 0 - dowolny towar); -1, gdy żaden wiersz nie pasuje.
+// Przy równych cenach wygrywa wiersz o najmniejszym indeksie.
+// Wersję wektorową (AVX2, SSE2 albo zwykła pętla) wybiera szukajCeny w czasie działania.
+
+template<bool Max>
+inline bool lepszaCena(double a, double b) {
+    return Max ? a > b : a < b;
+}
+
+template<bool Max>
+std::ptrdiff_t szukajCenySkalarnie(const double* ceny, const int* sztuki, const int* idTowarow,
+                                   int idTowaru, std::size_t od, std::size_t n, std::ptrdiff_t najlepszy)
+{
+    for (std::size_t i = od; i < n; i++) {
+        if (sztuki[i] > 0 && (idTowaru < 0 || idTowarow[i] == idTowaru)
+            && (najlepszy < 0 || lepszaCena<Max>(ceny[i], ceny[najlepszy]))) {
+            najlepszy = static_cast<std::ptrdiff_t>(i);
+        }
+    }
+    return najlepszy;
+}
+
+// Wybiera najlepszy z torów wektora (przy remisie - mniejszy indeks)
+template<bool Max>
+std::ptrdiff_t najlepszyTor(const double* wartosci, const double* indeksy, int torow) {
+    std::ptrdiff_t najlepszy = -1;
+    double wartosc = 0.0;
+    for (int t = 0; t < torow; t++) {
+        if (indeksy[t] < 0) {
+            continue;
+        }
+        std::ptrdiff_t i = static_cast<std::ptrdiff_t>(indeksy[t]);
+        if (najlepszy < 0 || lepszaCena<Max>(wartosci[t], wartosc)
+            || (wartosci[t] == wartosc && i < najlepszy)) {
+            najlepszy = i;
+            wartosc = wartosci[t];
+        }
+    }
+    return najlepszy;
+}
+
+#ifdef GIELDA_SIMD
+
+// Tor jest pusty, dopóki jego indeks < 0 - wtedy bierze każdy pasujący wiersz,
+// więc wynik nie zależy od wartości startowej (także dla cen ±HUGE_VAL)
+template<bool Max>
+std::ptrdiff_t szukajCenySSE2(const double* ceny, const int* sztuki, const int* idTowarow,
+                              int idTowaru, std::size_t n)
+{
+    const __m128i zero      = _mm_setzero_si128();
+    const __m128i szukany   = _mm_set1_epi32(idTowaru);
+    const __m128i wszystkie = _mm_set1_epi32(idTowaru < 0 ? -1 : 0);
+    __m128d wartosci = _mm_setzero_pd();
+    __m128d indeksy  = _mm_set1_pd(-1.0);
+    __m128d biezace  = _mm_setr_pd(0.0, 1.0);
+    const __m128d krok = _mm_set1_pd(2.0);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i szt = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sztuki + i));
+        __m128i tow = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(idTowarow + i));
+        __m128i pasuje32 = _mm_and_si128(_mm_cmpgt_epi32(szt, zero),
+                                         _mm_or_si128(_mm_cmpeq_epi32(tow, szukany), wszystkie));
+        __m128d pasuje = _mm_castsi128_pd(_mm_unpacklo_epi32(pasuje32, pasuje32));
+        __m128d c = _mm_loadu_pd(ceny + i);
+        __m128d pusty = _mm_cmplt_pd(indeksy, _mm_setzero_pd());
+        __m128d lepsza = _mm_and_pd(pasuje, _mm_or_pd(pusty, Max ? _mm_cmpgt_pd(c, wartosci)
+                                                                 : _mm_cmplt_pd(c, wartosci)));
+        wartosci = _mm_or_pd(_mm_and_pd(lepsza, c), _mm_andnot_pd(lepsza, wartosci));
+        indeksy  = _mm_or_pd(_mm_and_pd(lepsza, biezace), _mm_andnot_pd(lepsza, indeksy));
+        biezace  = _mm_add_pd(biezace, krok);
+    }
+    alignas(16) double w[2], ix[2];
+    _mm_store_pd(w, wartosci);
+    _mm_store_pd(ix, indeksy);
+    return szukajCenySkalarnie<Max>(ceny, sztuki, idTowarow, idTowaru, i, n, najlepszyTor<Max>(w, ix, 2));
+}
+
+template<bool Max>
+__attribute__((target("avx2")))
+std::ptrdiff_t szukajCenyAVX2(const double* ceny, const int* sztuki, const int* idTowarow,
+                              int idTowaru, std::size_t n)
+{
+    const __m128i zero      = _mm_setzero_si128();
+    const __m128i szukany   = _mm_set1_epi32(idTowaru);
+    const __m128i wszystkie = _mm_set1_epi32(idTowaru < 0 ? -1 : 0);
+    __m256d wartosci = _mm256_setzero_pd();
+    __m256d indeksy  = _mm256_set1_pd(-1.0);
+    __m256d biezace  = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+    const __m256d krok = _mm256_set1_pd(4.0);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i szt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sztuki + i));
+        __m128i tow = _mm_loadu_si128(reinterpret_cast<const __m128i*>(idTowarow + i));
+        __m128i pasuje32 = _mm_and_si128(_mm_cmpgt_epi32(szt, zero),
+                                         _mm_or_si128(_mm_cmpeq_epi32(tow, szukany), wszystkie));
+        __m256d pasuje = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(pasuje32));
+        __m256d c = _mm256_loadu_pd(ceny + i);
+        __m256d pusty = _mm256_cmp_pd(indeksy, _mm256_setzero_pd(), _CMP_LT_OQ);
+        __m256d lepsza = _mm256_and_pd(pasuje, _mm256_or_pd(pusty,
+                                       _mm256_cmp_pd(c, wartosci, Max ? _CMP_GT_OQ : _CMP_LT_OQ)));
+        wartosci = _mm256_blendv_pd(wartosci, c, lepsza);
+        indeksy  = _mm256_blendv_pd(indeksy, biezace, lepsza);
+        biezace  = _mm256_add_pd(biezace, krok);
+    }
+    alignas(32) double w[4], ix[4];
+    _mm256_store_pd(w, wartosci);
+    _mm256_store_pd(ix, indeksy);
+    return szukajCenySkalarnie<Max>(ceny, sztuki, idTowarow, idTowaru, i, n, najlepszyTor<Max>(w, ix, 4));
+}
+
+#endif
+
+template<bool Max>
+std::ptrdiff_t szukajCenyBezSIMD(const double* ceny, const int* sztuki, const int* idTowarow,
+                                 int idTowaru, std::size_t n)
+{
+    return szukajCenySkalarnie<Max>(ceny, sztuki, idTowarow, idTowaru, 0, n, -1);
+}
+
+// Wersję wybieramy raz, przy pierwszym skanie - AVX2 tylko tam, gdzie
+// procesor ją ma, niezależnie od flag kompilacji
+template<bool Max>
+std::ptrdiff_t szukajCeny(const double* ceny, const int* sztuki, const int* idTowarow,
+                          int idTowaru, std::size_t n)
+{
+    typedef std::ptrdiff_t (*Jadro)(const double*, const int*, const int*, int, std::size_t);
+    static const Jadro jadro = []() -> Jadro {
+#ifdef GIELDA_SIMD
+        if (__builtin_cpu_supports("avx2")) {
+            return szukajCenyAVX2<Max>;
+        }
+        return szukajCenySSE2<Max>;
+#else
+        return szukajCenyBezSIMD<Max>;
+#endif
+    }();
+    return jadro(ceny, sztuki, idTowarow, idTowaru, n);
+}
+
+// -----------------------------------------------------------
+//   AtomoweSztuki (atomowy dostęp do komórki kolumny sztuk)
+// -----------------------------------------------------------
+// Komórka jest zwykłym int, więc nie czytamy std::atomic przez int*;
+// współbieżne zakupy sięgają do niej wyłącznie przez te funkcje.
+namespace AtomoweSztuki {
+
+inline int wczytaj(int& komorka) {
+#if defined(__cpp_lib_atomic_ref)
+    return std::atomic_ref<int>(komorka).load(std::memory_order_acquire);
+#else
+    return __atomic_load_n(&komorka, __ATOMIC_ACQUIRE);
+#endif
+}
+
+inline bool zamien(int& komorka, int& oczekiwane, int nowe) {
+#if defined(__cpp_lib_atomic_ref)
+    return std::atomic_ref<int>(komorka).compare_exchange_weak(oczekiwane, nowe, std::memory_order_acq_rel);
+#else
+    return __atomic_compare_exchange_n(&komorka, &oczekiwane, nowe, true,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+} // namespace AtomoweSztuki
+
+// -----------------------------------------------------------
+//   Klasa KolumnyOfert (oferty jako struktura tablic)
+// -----------------------------------------------------------
+// Wiersz i opisuje i-tą ofertę z puli giełdy. Kolumny są trzymane blokami,
+// więc adresy komórek się nie zmieniają - Oferta wskazuje wprost na swoją
+// komórkę w kolumnie sztuk, a ta jest jedynym miejscem, gdzie żyje liczba sztuk.
+// Kolumna sztuk to zwykłe int: skan czyta ją wprost, a Oferta zmienia ją
+// operacjami atomowymi na komórce (AtomoweSztuki).
+// Skanowania nie należy puszczać równolegle z kupTowarRownolegle.
+class KolumnyOfert {
+public:
+    static const std::size_t WIERSZY_W_BLOKU = 256;
+
+    KolumnyOfert() : m_rozmiar(0) {}
+
+    KolumnyOfert(const KolumnyOfert&) = delete;
+    KolumnyOfert& operator=(const KolumnyOfert&) = delete;
+
+    std::size_t dodaj(double cena, int sztuki, int idTowaru, int idSprzedajacego) {
+        if (m_rozmiar == m_bloki.size() * WIERSZY_W_BLOKU) {
+            m_bloki.emplace_back(new Blok);
+        }
+        Blok& b = *m_bloki.back();
+        std::size_t j = m_rozmiar % WIERSZY_W_BLOKU;
+        b.ceny[j]            = cena;
+        b.sztuki[j]          = sztuki;
+        b.idTowaru[j]        = idTowaru;
+        b.idSprzedajacego[j] = idSprzedajacego;
+        return m_rozmiar++;
+    }
+
+    // Dopisuje n wierszy wprost z kolumn (np. zmapowanej migawki) - kopiuje
+    // całe kawałki kolumn, bez składania wiersz po wierszu. Dane nie muszą
+    // być wyrównane. Zwraca numer pierwszego dopisanego wiersza.
+    std::size_t dodajKolumny(const char* ceny, const char* sztuki, const char* idTowaru,
+                             const char* idSprzedajacego, std::size_t n) {
+        std::size_t pierwszy = m_rozmiar;
+        std::size_t zrobione = 0;
+        while (zrobione < n) {
+            if (m_rozmiar == m_bloki.size() * WIERSZY_W_BLOKU) {
+                m_bloki.emplace_back(new Blok);
+            }
+            Blok& b = *m_bloki.back();
+            std::size_t j = m_rozmiar % WIERSZY_W_BLOKU;
+            std::size_t ile = std::min(WIERSZY_W_BLOKU - j, n - zrobione);
+            std::memcpy(b.ceny + j,            ceny + zrobione * sizeof(double),            ile * sizeof(double));
+            std::memcpy(b.sztuki + j,          sztuki + zrobione * sizeof(int),             ile * sizeof(int));
+            std::memcpy(b.idTowaru + j,        idTowaru + zrobione * sizeof(int),           ile * sizeof(int));
+            std::memcpy(b.idSprzedajacego + j, idSprzedajacego + zrobione * sizeof(int),    ile * sizeof(int));
+            m_rozmiar += ile;
+            zrobione += ile;
+        }
+        return pierwszy;
+    }
+
+    double cena(std::size_t wiersz) const       { return blok(wiersz).ceny[wiersz % WIERSZY_W_BLOKU]; }
+    int idTowaru(std::size_t wiersz) const      { return blok(wiersz).idTowaru[wiersz % WIERSZY_W_BLOKU]; }
+    int idSprzedajacego(std::size_t wiersz) const {
+        return blok(wiersz).idSprzedajacego[wiersz % WIERSZY_W_BLOKU];
+    }
+
+    int& sztuki(std::size_t wiersz) {
+        return m_bloki[wiersz / WIERSZY_W_BLOKU]->sztuki[wiersz % WIERSZY_W_BLOKU];
+    }
+
+    // Bloki zmieniają tylko właściciela - komórki sztuk zostają pod tymi samymi adresami
+    void zamien(KolumnyOfert& inne) {
+        m_bloki.swap(inne.m_bloki);
+        std::swap(m_rozmiar, inne.m_rozmiar);
+    }
+
+    std::size_t rozmiar() const { return m_rozmiar; }
+
+    // Wiersz z najniższą / najwyższą ceną (idTowaru < 0 - wszystkie towary), -1 gdy brak
+    std::ptrdiff_t najtanszy(int idTowaru) const  { return szukaj<false>(idTowaru); }
+    std::ptrdiff_t najdrozszy(int idTowaru) const { return szukaj<true>(idTowaru); }
+
+private:
+    struct Blok {
+        alignas(32) double           ceny[WIERSZY_W_BLOKU];
+        alignas(32) int              sztuki[WIERSZY_W_BLOKU];
+        alignas(32) int              idTowaru[WIERSZY_W_BLOKU];
+        alignas(32) int              idSprzedajacego[WIERSZY_W_BLOKU];
+    };
+
+    const Blok& blok(std::size_t wiersz) const {
+        return *m_bloki[wiersz / WIERSZY_W_BLOKU];
+    }
+
+    template<bool Max>
+    std::ptrdiff_t szukaj(int idTowaru) const {
+        std::ptrdiff_t najlepszy = -1;
+        double cena = 0.0;
+        for (std::size_t b = 0; b < m_bloki.size(); b++) {
+            const Blok& blok = *m_bloki[b];
+            std::size_t n = (b + 1 < m_bloki.size()) ? WIERSZY_W_BLOKU : m_rozmiar - b * WIERSZY_W_BLOKU;
+            std::ptrdiff_t i = szukajCeny<Max>(blok.ceny, blok.sztuki, blok.idTowaru, idTowaru, n);
+            // ściśle lepsza - przy remisie zostaje wcześniejszy blok
+            if (i >= 0 && (najlepszy < 0 || lepszaCena<Max>(blok.ceny[i], cena))) {
+                najlepszy = static_cast<std::ptrdiff_t>(b * WIERSZY_W_BLOKU) + i;
+                cena = blok.ceny[i];
+            }
+        }
+        return najlepszy;
+    }
+
+    std::vector<std::unique_ptr<Blok>> m_bloki;
+    std::size_t                        m_rozmiar;
+};
 
 // -----------------------------------------------------------
 //   Klasa Oferta
 // -----------------------------------------------------------
 class Sprzedajacy; // deklaracja w przód
+class Gielda;
 
 class Oferta {
 public:
-    Oferta(const std::string& nazwaTowaru, double cena, int liczbaSztuk, Sprzedajacy* sprzed)
+    // Liczba sztuk żyje w kolumnie giełdy (KolumnyOfert) - oferta tylko na nią wskazuje.
+    // Nazwa towaru nie jest kopiowana: to napis z tablicy symboli giełdy o id idTowaru.
+    // nr - pozycja oferty w puli giełdy (i wiersz w jej kolumnach)
+    Oferta(const std::string& nazwaTowaru, int idTowaru, double cena, int& liczbaSztuk,
+           Sprzedajacy* sprzed, int nr)
         : m_nazwaTowaru(nazwaTowaru),
+          m_idTowaru(idTowaru),
           m_cena(cena),
           m_liczbaSztuk(liczbaSztuk),
-          m_sprzedajacy(sprzed)
+          m_sprzedajacy(sprzed),
+          m_nr(nr)
     {
     }
 
@@ -24,23 +440,37 @@ public:
 
     // brak wywołania jakichś wyjątków – w razie błędu tylko wypisujemy
     void sprzedajSztuki(int ile) {
-        if (ile <= 0 || ile > m_liczbaSztuk) {
+        if (!zarezerwujSztuki(ile)) {
             std::cerr << "[Oferta] Błędna liczba sztuk do sprzedaży!\n";
-            return;
         }
-        m_liczbaSztuk -= ile;
+    }
+
+    // Atomowo zdejmuje 'ile' sztuk (CAS) - dwa wątki nigdy nie sprzedadzą
+    // tej samej sztuki. Zwraca false i nic nie zmienia, gdy sztuk jest za mało.
+    bool zarezerwujSztuki(int ile) {
+        int jest = AtomoweSztuki::wczytaj(m_liczbaSztuk);
+        do {
+            if (ile <= 0 || ile > jest) {
+                return false;
+            }
+        } while (!AtomoweSztuki::zamien(m_liczbaSztuk, jest, jest - ile));
+        return true;
     }
 
     const std::string& getNazwaTowaru() const { return m_nazwaTowaru; }
+    int getIdTowaru() const                   { return m_idTowaru; }
     double getCena() const                    { return m_cena; }
-    int getLiczbaSztuk() const               { return m_liczbaSztuk; }
+    int getLiczbaSztuk() const               { return AtomoweSztuki::wczytaj(m_liczbaSztuk); }
     Sprzedajacy* getSprzedajacy() const      { return m_sprzedajacy; }
+    int getNr() const                        { return m_nr; }
 
 private:
-    std::string   m_nazwaTowaru;
-    double        m_cena;
-    int           m_liczbaSztuk;
-    Sprzedajacy*  m_sprzedajacy;
+    const std::string& m_nazwaTowaru;
+    int                m_idTowaru;
+    double             m_cena;
+    int&               m_liczbaSztuk;
+    Sprzedajacy*       m_sprzedajacy;
+    int                m_nr;
 };
 
 // -----------------------------------------------------------
@@ -48,8 +478,11 @@ private:
 // -----------------------------------------------------------
 class Sprzedajacy {
 public:
-    explicit Sprzedajacy(const std::string& unikatowyId)
-        : m_id(unikatowyId)
+    // Tworzony przez Gielda::utworzSprzedajacego - oferty wystawia na tej giełdzie,
+    // nr to jego pozycja w puli sprzedających (kolumna idSprzedajacego).
+    // unikatowyId to napis z tablicy uczestników giełdy (symbol - jego id w tej tablicy).
+    Sprzedajacy(const std::string& unikatowyId, int symbol, Gielda* g, int nr)
+        : m_id(unikatowyId), m_symbol(symbol), m_gielda(g), m_nr(nr)
     {
     }
 
@@ -58,36 +491,87 @@ public:
     Sprzedajacy& operator=(const Sprzedajacy&) = delete;
 
     // Giełda będzie zwalniać pamięć, więc w destruktorze nic nie robimy
-    ~Sprzedajacy() {
-    }
+    // (domyślny - pula nie woła go dla każdego sprzedającego osobno)
+    ~Sprzedajacy() = default;
 
     const std::string& getId() const {
         return m_id;
     }
 
-    Oferta* wystawOferte(const std::string& nazwaTowaru, double cena, int liczbaSztuk) {
-        Oferta* nowa = new Oferta(nazwaTowaru, cena, liczbaSztuk, this);
-        m_mojeOferty.push_back(nowa);
-        return nowa;
+    // Id z tablicy uczestników - ten sam dla równych napisów
+    int getSymbol() const {
+        return m_symbol;
     }
 
+    int getNr() const {
+        return m_nr;
+    }
+
+    // Oferta powstaje w puli giełdy i od razu trafia do księgi towaru
+    Oferta* wystawOferte(const std::string& nazwaTowaru, double cena, int liczbaSztuk);
+
 private:
-    std::string        m_id;
-    std::vector<Oferta*> m_mojeOferty; // (opcjonalnie) Sprzedawca pamięta swoje oferty
+    friend class Gielda;    // przepina sprzedających po wczytaniu migawki
+
+    const std::string&  m_id;
+    int                 m_symbol;
+    Gielda*             m_gielda;
+    int                 m_nr;
 };
 
+static_assert(std::is_trivially_destructible<Sprzedajacy>::value &&
+              std::is_trivially_destructible<Oferta>::value,
+              "pule sprzedających i ofert zwalniają same bloki");
+
 // -----------------------------------------------------------
 //   Deklaracja klasy Gielda (użyta w Kupujacy)
 // -----------------------------------------------------------
-class Gielda;
+
+// Księga ofert jednego towaru: oferty uporządkowane rosnąco po cenie,
+// a przy równej cenie - w kolejności dodania do giełdy.
+typedef std::multimap<double, Oferta*> KsiegaOfert;
+class PrzebiegKsiegi;
+
+// -----------------------------------------------------------
+//   Zdarzenia handlowe
+// -----------------------------------------------------------
+// Strategie nie piszą same na ekran - zgłaszają zwięzłe zdarzenia, które
+// giełda przekazuje w tle do wybranego odbiorcy (OdbiorcaZdarzen).
+class Kupujacy;
+
+enum class KodZdarzenia : std::uint8_t {
+    KUPIL,       // transakcja doszła do skutku
+    BRAK_OFERT,  // na towar nie ma żadnej oferty z > 0 sztuk
+    ZA_DROGO     // oferty są, ale nie starcza budżetu
+};
+
+struct ZdarzenieHandlowe {
+    const Kupujacy*    kupujacy;
+    const std::string* towar;     // nazwa z tablicy symboli giełdy (adres się nie zmienia),
+                                  // nullptr dla towaru, którego nikt nie wystawił
+    double             cena;      // 0 poza KUPIL
+    std::int32_t       idOferty;  // nr oferty w puli giełdy, -1 poza KUPIL
+    std::int32_t       idTowaru;
+    std::int32_t       sztuk;
+    KodZdarzenia       kod;
+};
+
+// Rodzaj strategii - zapisywany w migawce stanu giełdy
+enum class RodzajKupujacego : std::uint8_t {
+    EKONOMICZNY,
+    WYBREDNY,
+    DETALISTA
+};
 
 // -----------------------------------------------------------
 //   Klasa bazowa Kupujacy (ABSTRAKCYJNA, z metodą wirtualną)
 // -----------------------------------------------------------
 class Kupujacy {
 public:
-    Kupujacy(const std::string& id, double budzet)
-        : m_id(id), m_budzet(budzet)
+    // Tworzony przez Gielda::utworzKupujacego - id to napis z tablicy
+    // uczestników giełdy, a symbol jego id w tej tablicy
+    Kupujacy(const std::string& id, int symbol, double budzet)
+        : m_id(id), m_symbol(symbol), m_budzet(budzet)
     {
     }
 
@@ -98,23 +582,56 @@ public:
     }
 
     const std::string& getId() const   { return m_id; }
-    double getBudzet() const          { return m_budzet; }
+    int getSymbol() const             { return m_symbol; }
+    double getBudzet() const          { return m_budzet.load(std::memory_order_acquire); }
 
     // Zmniejsza budżet. Jeśli kwota > m_budzet, tylko wypisze błąd.
     void zmniejszBudzet(double kwota) {
-        if (kwota > m_budzet) {
+        if (!sprobujWydac(kwota)) {
             std::cerr << "[Kupujacy] Budżet za mały, nie można kupić!\n";
-            return;
         }
-        m_budzet -= kwota;
     }
 
+    // Atomowo (CAS) pobiera kwotę z budżetu - kupujący obsługiwany przez kilka
+    // wątków naraz nie wyda więcej, niż ma. Zwraca false, gdy budżet za mały.
+    bool sprobujWydac(double kwota) {
+        double jest = m_budzet.load(std::memory_order_relaxed);
+        do {
+            if (kwota > jest) {
+                return false;
+            }
+        } while (!m_budzet.compare_exchange_weak(jest, jest - kwota, std::memory_order_acq_rel));
+        return true;
+    }
+
+    // Oddaje kwotę pobraną przez sprobujWydac, gdy towaru jednak zabrakło
+    void zwrocBudzet(double kwota) {
+        double jest = m_budzet.load(std::memory_order_relaxed);
+        while (!m_budzet.compare_exchange_weak(jest, jest + kwota, std::memory_order_acq_rel)) {
+        }
+    }
+
+    // Odszukuje księgę towaru i realizuje strategię (kupZKsiegi).
+    void kup(const std::string& nazwaTowaru, Gielda* g);
+
+    // Zakup z księgi, którą odszukała już giełda - w osobnym przebiegu.
+    void kupZKsiegi(KsiegaOfert* ksiega, int idTowaru, Gielda* g);
+
     // Metoda czysto wirtualna (implementacje w podklasach - różne strategie).
-    virtual void kup(const std::string& nazwaTowaru, Gielda* g) = 0;
+    // Przebieg bywa wspólny dla całej tury kupujących (Gielda::kupTowarGrupowo).
+    virtual void kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g) = 0;
+
+    // Do opisu zdarzeń, np. "[Ekonomiczny:Klient_Eko] Za drogo, nie kupił."
+    virtual const char* nazwaStrategii() const = 0;
+    virtual const char* opisOdmowy() const = 0;
+    virtual RodzajKupujacego rodzaj() const = 0;
 
 protected:
-    std::string m_id;
-    double      m_budzet;
+    void zglos(Gielda* g, KodZdarzenia kod, int idTowaru, const Oferta* of = nullptr, int sztuk = 0) const;
+
+    const std::string&   m_id;
+    int                  m_symbol;
+    std::atomic<double>  m_budzet;
 };
 
 // -----------------------------------------------------------
@@ -124,288 +641,1606 @@ protected:
 // Kupuje 1 szt. z najtańszej dostępnej oferty
 class KupujacyEkonomiczny : public Kupujacy {
 public:
-    KupujacyEkonomiczny(const std::string& id, double budzet)
-        : Kupujacy(id, budzet)
+    KupujacyEkonomiczny(const std::string& id, int symbol, double budzet)
+        : Kupujacy(id, symbol, budzet)
     {}
 
-    void kup(const std::string& nazwaTowaru, Gielda* g) override;
+    void kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g) override;
+    const char* nazwaStrategii() const override { return "Ekonomiczny"; }
+    const char* opisOdmowy() const override     { return "Za drogo, nie kupił."; }
+    RodzajKupujacego rodzaj() const override    { return RodzajKupujacego::EKONOMICZNY; }
 };
 
 // Kupuje 1 szt. z najdroższej dostępnej oferty
 class KupujacyWybredny : public Kupujacy {
 public:
-    KupujacyWybredny(const std::string& id, double budzet)
-        : Kupujacy(id, budzet)
+    KupujacyWybredny(const std::string& id, int symbol, double budzet)
+        : Kupujacy(id, symbol, budzet)
     {}
 
-    void kup(const std::string& nazwaTowaru, Gielda* g) override;
+    void kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g) override;
+    const char* nazwaStrategii() const override { return "Wybredny"; }
+    const char* opisOdmowy() const override     { return "Nie stać mnie na najdroższe!"; }
+    RodzajKupujacego rodzaj() const override    { return RodzajKupujacego::WYBREDNY; }
 };
 
 // Kupuje po 1 sztuce z każdej oferty, zaczynając od najtańszej
+// Tryb z limitem (limitSztuk > 0): kupuje łącznie do limitSztuk sztuk,
+// biorąc z każdej oferty tyle, ile się da, zanim przejdzie do droższej
 class KupujacyDetalista : public Kupujacy {
 public:
-    KupujacyDetalista(const std::string& id, double budzet)
-        : Kupujacy(id, budzet)
+    KupujacyDetalista(const std::string& id, int symbol, double budzet, int limitSztuk = 0)
+        : Kupujacy(id, symbol, budzet), m_limitSztuk(limitSztuk)
     {}
 
-    void kup(const std::string& nazwaTowaru, Gielda* g) override;
+    void kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g) override;
+    const char* nazwaStrategii() const override { return "Detalista"; }
+    const char* opisOdmowy() const override     { return "Nic nie kupiłem (za drogo)."; }
+    RodzajKupujacego rodzaj() const override    { return RodzajKupujacego::DETALISTA; }
+
+    int getLimitSztuk() const { return m_limitSztuk; }
+
+private:
+    int m_limitSztuk; // 0 - po 1 szt. z każdej oferty
 };
 
 // -----------------------------------------------------------
-//   Klasa Gielda
+//   Klasa PrzebiegKsiegi
 // -----------------------------------------------------------
-class Gielda {
+// Jeden przebieg po księdze towaru, wspólny dla wszystkich kupujących z tury.
+// Granice przesuwają się tylko do środka: m_przod - najtańsza oferta z > 0
+// sztuk, m_tyl - pozycja za najdroższą. Sprzedaż tylko zdejmuje sztuki;
+// wyczerpane oferty są omijane, a z księgi wypadają hurtem w zakoncz().
+class PrzebiegKsiegi {
 public:
-    Gielda() {
-        // Inicjalizujemy generator liczb pseudolosowych
-        std::random_device rd;
-        m_gen.seed(rd());
+    explicit PrzebiegKsiegi(KsiegaOfert* ksiega)
+        : m_ksiega(ksiega)
+    {
+        if (m_ksiega != nullptr) {
+            m_przod  = m_ksiega->begin();
+            m_tyl    = m_ksiega->end();
+            m_zasieg = m_przod;
+        }
     }
 
-    ~Gielda() {
-        // Zwalniamy wszystko to, co 'posiadamy'
-        for (std::size_t i = 0; i < m_oferty.size(); i++) {
-            delete m_oferty[i];
+    ~PrzebiegKsiegi() {
+        zakoncz();
+    }
+
+    PrzebiegKsiegi(const PrzebiegKsiegi&) = delete;
+    PrzebiegKsiegi& operator=(const PrzebiegKsiegi&) = delete;
+
+    // Najtańsza oferta z > 0 sztuk (przy remisie - dodana najwcześniej) albo nullptr
+    Oferta* najtansza() {
+        if (m_ksiega == nullptr) {
+            return nullptr;
+        }
+        return zywa(m_przod);
+    }
+
+    // Najdroższa oferta z > 0 sztuk (przy remisie - dodana najwcześniej) albo nullptr
+    Oferta* najdrozsza() {
+        if (najtansza() == nullptr) {
+            return nullptr;
         }
-        for (std::size_t i = 0; i < m_sprzedajacy.size(); i++) {
-            delete m_sprzedajacy[i];
+        // m_przod jest żywa, więc pętla zatrzyma się najpóźniej na niej
+        while (std::prev(m_tyl)->second->getLiczbaSztuk() == 0) {
+            cofnijTyl();
         }
-        for (std::size_t i = 0; i < m_kupujacy.size(); i++) {
-            delete m_kupujacy[i];
+        auto it = m_ksiega->lower_bound(std::prev(m_tyl)->first);
+        while (it->second->getLiczbaSztuk() == 0) {
+            ++it;
         }
+        return it->second;
     }
 
-    // uniemożliwiamy kopiowanie Gieldy
-    Gielda(const Gielda&) = delete;  
-    Gielda(const Gielda &other)
-    {
-        // Uwaga: przypisujemy wektory wskaźników wprost
-        // Oba obiekty Gielda będą pokazywały na TE SAME obiekty Sprzedajacy, Kupujacy, Oferta!
-        m_sprzedajacy = other.m_sprzedajacy;
-        m_kupujacy    = other.m_kupujacy;
-        m_oferty      = other.m_oferty;
+    // Atomowo zdejmuje sztuki z oferty znalezionej w tym przebiegu
+    bool sprzedaj(Oferta* of, int ile) {
+        return of->zarezerwujSztuki(ile);
+    }
 
-        // Możemy skopiować też stan generatora:
-        m_gen = other.m_gen;
+    // Oferta pod it albo pierwsza żywa za nią (it przesuwa się na nią); nullptr na końcu
+    Oferta* zywa(KsiegaOfert::iterator& it) {
+        while (it != m_tyl && it->second->getLiczbaSztuk() == 0) {
+            odwiedz(it);
+            ++it;
+        }
+        if (it == m_tyl) {
+            return nullptr;
+        }
+        odwiedz(it);
+        return it->second;
     }
-    
 
+    // Pozycja najtańszej żywej oferty - początek przejścia kursorem
+    KsiegaOfert::iterator poczatek() {
+        najtansza();
+        return m_przod;
+    }
 
-    Gielda& operator=(const Gielda&) = delete;
-    Gielda& operator=(const Gielda &other)
-    {
-        if (this != &other) {
-            // Najpierw zwalniamy "własne" obiekty,
-            // bo zaraz nadpiszemy wskaźniki.
-            for (auto* s : m_sprzedajacy) delete s;
-            for (auto* k : m_kupujacy)    delete k;
-            for (auto* o : m_oferty)     delete o;
+    // Usuwa z księgi wyczerpane oferty, przez które przeszedł przebieg
+    void zakoncz() {
+        if (m_ksiega == nullptr) {
+            return;
+        }
+        for (auto it = m_ksiega->begin(); it != m_zasieg; ) {
+            it = it->second->getLiczbaSztuk() == 0 ? m_ksiega->erase(it) : std::next(it);
+        }
+        m_ksiega->erase(m_tyl, m_ksiega->end());
+        m_ksiega = nullptr;
+    }
+
+private:
+    // m_zasieg - pierwsza pozycja, do której nikt jeszcze nie zajrzał od przodu;
+    // idąc krok po kroku nie da się jej przeskoczyć, więc wystarczy porównanie
+    void odwiedz(KsiegaOfert::iterator it) {
+        if (it == m_zasieg) {
+            ++m_zasieg;
+        }
+    }
 
-            // Teraz kopiujemy wskaźniki.
-            // Uwaga: to spowoduje "współdzielenie" obiektów między dwiema giełdami!
-            m_sprzedajacy = other.m_sprzedajacy;
-            m_kupujacy    = other.m_kupujacy;
-            m_oferty      = other.m_oferty;
-            m_gen         = other.m_gen;
+    // m_zasieg nigdy nie wychodzi poza m_tyl
+    void cofnijTyl() {
+        bool zasiegNaTyle = m_zasieg == m_tyl;
+        --m_tyl;
+        if (zasiegNaTyle) {
+            m_zasieg = m_tyl;
         }
-        return *this;
     }
 
+    KsiegaOfert*          m_ksiega;
+    KsiegaOfert::iterator m_przod;
+    KsiegaOfert::iterator m_tyl;
+    KsiegaOfert::iterator m_zasieg;
+};
 
-    void zarejestrujSprzedajacego(Sprzedajacy* s) {
-        m_sprzedajacy.push_back(s);
+// -----------------------------------------------------------
+//   Klasa KursorKsiegi
+// -----------------------------------------------------------
+// Przechodzi w ramach przebiegu od najtańszej oferty, bez kopiowania i sortowania.
+class KursorKsiegi {
+public:
+    explicit KursorKsiegi(PrzebiegKsiegi& przebieg)
+        : m_przebieg(przebieg), m_it(przebieg.poczatek())
+    {
     }
 
-    void zarejestrujKupujacego(Kupujacy* k) {
-        m_kupujacy.push_back(k);
+    // Bieżąca oferta z > 0 sztuk albo nullptr na końcu księgi
+    Oferta* biezaca() {
+        return m_przebieg.zywa(m_it);
     }
 
-    void dodajOferte(Oferta* o) {
-        m_oferty.push_back(o);
+    // Sprzedaje sztuki z bieżącej oferty i przechodzi do następnej.
+    // Gdy sztuk już nie ma (zabrał je inny wątek) - zwraca false i stoi w miejscu.
+    bool sprzedajIDalej(int ile) {
+        if (!m_przebieg.sprzedaj(m_it->second, ile)) {
+            return false;
+        }
+        ++m_it;
+        return true;
     }
 
-    // Zwraca wszystkie oferty na dany towar, w których jest > 0 sztuk
-    std::vector<Oferta*> znajdzOferty(const std::string& nazwaTowaru) {
-        std::vector<Oferta*> wynik;
-        for (std::size_t i = 0; i < m_oferty.size(); i++) {
-            Oferta* of = m_oferty[i];
-            if (of->getNazwaTowaru() == nazwaTowaru && of->getLiczbaSztuk() > 0) {
-                wynik.push_back(of);
-            }
+private:
+    PrzebiegKsiegi&       m_przebieg;
+    KsiegaOfert::iterator m_it;
+};
+
+// -----------------------------------------------------------
+//   Szablon KolejkaBezBlokad
+// -----------------------------------------------------------
+
+// Ograniczona kolejka bez blokad (wielu piszących, wielu czytających):
+// każda komórka ma licznik sekwencji mówiący, czy można do niej pisać,
+// czy z niej czytać. Pojemnosc musi być potęgą dwójki.
+template<typename T, std::size_t Pojemnosc>
+class KolejkaBezBlokad {
+    static_assert((Pojemnosc & (Pojemnosc - 1)) == 0, "Pojemnosc musi byc potega 2");
+
+public:
+    KolejkaBezBlokad()
+        : m_zapis(0), m_odczyt(0)
+    {
+        for (std::size_t i = 0; i < Pojemnosc; i++) {
+            m_komorki[i].sekwencja.store(i, std::memory_order_relaxed);
         }
-        return wynik;
     }
 
-    // Kupujący kupuje towar -> wywołujemy polimorficzną metodę kup(...)
-    void kupTowar(Kupujacy* k, const std::string& nazwaTowaru) {
-        k->kup(nazwaTowaru, this);
+    KolejkaBezBlokad(const KolejkaBezBlokad&) = delete;
+    KolejkaBezBlokad& operator=(const KolejkaBezBlokad&) = delete;
+
+    // false - kolejka pełna
+    bool wstaw(const T& x) {
+        std::size_t poz = m_zapis.load(std::memory_order_relaxed);
+        for (;;) {
+            Komorka& k = m_komorki[poz & (Pojemnosc - 1)];
+            std::size_t sek = k.sekwencja.load(std::memory_order_acquire);
+            std::ptrdiff_t roznica = static_cast<std::ptrdiff_t>(sek) - static_cast<std::ptrdiff_t>(poz);
+            if (roznica == 0) {
+                if (m_zapis.compare_exchange_weak(poz, poz + 1, std::memory_order_relaxed)) {
+                    k.dane = x;
+                    k.sekwencja.store(poz + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (roznica < 0) {
+                return false;
+            } else {
+                poz = m_zapis.load(std::memory_order_relaxed);
+            }
+        }
     }
 
-    // Prosty wypis stanu giełdy
-    void wypiszStan() {
-        std::cout << "\n=== STAN GIELDY ===\n";
-        for (std::size_t i = 0; i < m_oferty.size(); i++) {
-            Oferta* of = m_oferty[i];
-            std::cout << "Towar: " << of->getNazwaTowaru()
-                      << ", cena: " << of->getCena()
-                      << ", sztuk: " << of->getLiczbaSztuk()
-                      << ", sprzedajacy: " << of->getSprzedajacy()->getId()
-                      << "\n";
+    // false - kolejka pusta
+    bool pobierz(T& x) {
+        std::size_t poz = m_odczyt.load(std::memory_order_relaxed);
+        for (;;) {
+            Komorka& k = m_komorki[poz & (Pojemnosc - 1)];
+            std::size_t sek = k.sekwencja.load(std::memory_order_acquire);
+            std::ptrdiff_t roznica = static_cast<std::ptrdiff_t>(sek) - static_cast<std::ptrdiff_t>(poz + 1);
+            if (roznica == 0) {
+                if (m_odczyt.compare_exchange_weak(poz, poz + 1, std::memory_order_relaxed)) {
+                    x = k.dane;
+                    k.sekwencja.store(poz + Pojemnosc, std::memory_order_release);
+                    return true;
+                }
+            } else if (roznica < 0) {
+                return false;
+            } else {
+                poz = m_odczyt.load(std::memory_order_relaxed);
+            }
         }
-        std::cout << "====================\n";
     }
 
-    // Potrzebny np. w strategiach losowych (nie używamy w tym przykładzie)
-    std::mt19937& getGen() { return m_gen; }
+    // Ile elementów wstawiono od początku
+    std::size_t wstawione() const {
+        return m_zapis.load(std::memory_order_acquire);
+    }
 
 private:
-    std::vector<Sprzedajacy*> m_sprzedajacy;
-    std::vector<Kupujacy*>    m_kupujacy;
-    std::vector<Oferta*>      m_oferty;
-    std::mt19937 m_gen;
+    struct Komorka {
+        std::atomic<std::size_t> sekwencja;
+        T                        dane;
+    };
+
+    Komorka                               m_komorki[Pojemnosc];
+    alignas(64) std::atomic<std::size_t>  m_zapis;
+    alignas(64) std::atomic<std::size_t>  m_odczyt;
 };
 
 // -----------------------------------------------------------
-//   Implementacje metod kup(...) w strategiach Kupujacy
+//   Odbiorcy zdarzeń i dziennik
 // -----------------------------------------------------------
 
-void KupujacyEkonomiczny::kup(const std::string& nazwaTowaru, Gielda* g)
-{
-    std::vector<Oferta*> oferty = g->znajdzOferty(nazwaTowaru);
-    if (oferty.empty()) {
-        std::cout << "[Ekonomiczny:" << getId()
-                  << "] Brak ofert na " << nazwaTowaru << "\n";
-        return;
+// Interfejs odbiorcy - wywoływany z wątku dziennika, po jednym zdarzeniu
+class OdbiorcaZdarzen {
+public:
+    virtual ~OdbiorcaZdarzen() {
+    }
+    virtual void odbierz(const ZdarzenieHandlowe& z) = 0;
+};
+
+// Dotychczasowe komunikaty tekstowe jako jeden z możliwych odbiorców
+class OdbiorcaTekstowy : public OdbiorcaZdarzen {
+public:
+    explicit OdbiorcaTekstowy(std::ostream& os)
+        : m_os(os)
+    {
     }
-    // Ręczne szukanie najtańszej (bez <algorithm>)
-    Oferta* najtansza = oferty[0];
-    for (std::size_t i = 1; i < oferty.size(); i++) {
-        if (oferty[i]->getCena() < najtansza->getCena()) {
-            najtansza = oferty[i];
+
+    void odbierz(const ZdarzenieHandlowe& z) override {
+        m_os << "[" << z.kupujacy->nazwaStrategii() << ":" << z.kupujacy->getId() << "] ";
+        switch (z.kod) {
+        case KodZdarzenia::KUPIL:
+            m_os << "Kupił " << z.sztuk << " szt. '" << *z.towar << "' za " << z.cena << "\n";
+            break;
+        case KodZdarzenia::BRAK_OFERT:
+            m_os << "Brak ofert na " << (z.towar != nullptr ? z.towar->c_str() : "nieznany towar") << "\n";
+            break;
+        case KodZdarzenia::ZA_DROGO:
+            m_os << z.kupujacy->opisOdmowy() << "\n";
+            break;
         }
     }
-    double cena = najtansza->getCena();
-    if (cena <= getBudzet() && najtansza->getLiczbaSztuk() > 0) {
-        zmniejszBudzet(cena);
-        najtansza->sprzedajSztuki(1);
-        std::cout << "[Ekonomiczny:" << getId()
-                  << "] Kupił 1 szt. '" << nazwaTowaru
-                  << "' za " << cena << "\n";
-    } else {
-        std::cout << "[Ekonomiczny:" << getId()
-                  << "] Za drogo, nie kupił.\n";
+
+private:
+    std::ostream& m_os;
+};
+
+#ifndef GIELDA_BEZ_ZDARZEN
+
+// Dziennik giełdy: strategie wrzucają zdarzenia do kolejki, a osobny wątek
+// przekazuje je odbiorcy. Bez odbiorcy zdarzenia są od razu pomijane.
+class DziennikZdarzen {
+public:
+    DziennikZdarzen()
+        : m_odbiorca(nullptr), m_koniec(false), m_obsluzone(0)
+    {
     }
-}
 
-void KupujacyWybredny::kup(const std::string& nazwaTowaru, Gielda* g)
-{
-    std::vector<Oferta*> oferty = g->znajdzOferty(nazwaTowaru);
-    if (oferty.empty()) {
-        std::cout << "[Wybredny:" << getId()
-                  << "] Brak ofert na " << nazwaTowaru << "\n";
-        return;
+    ~DziennikZdarzen() {
+        zatrzymaj();
+        delete m_odbiorca;
     }
-    // Ręczne szukanie najdroższej
-    Oferta* najdrozsza = oferty[0];
-    for (std::size_t i = 1; i < oferty.size(); i++) {
-        if (oferty[i]->getCena() > najdrozsza->getCena()) {
-            najdrozsza = oferty[i];
+
+    DziennikZdarzen(const DziennikZdarzen&) = delete;
+    DziennikZdarzen& operator=(const DziennikZdarzen&) = delete;
+
+    // Dziennik przejmuje odbiorcę na własność (nullptr - bez odbiorcy)
+    void ustawOdbiorce(OdbiorcaZdarzen* odbiorca) {
+        zatrzymaj();
+        delete m_odbiorca;
+        m_odbiorca = odbiorca;
+        if (m_odbiorca != nullptr) {
+            m_koniec.store(false, std::memory_order_relaxed);
+            m_watek = std::thread(&DziennikZdarzen::petla, this);
         }
     }
-    double cena = najdrozsza->getCena();
-    if (cena <= getBudzet() && najdrozsza->getLiczbaSztuk() > 0) {
-        zmniejszBudzet(cena);
-        najdrozsza->sprzedajSztuki(1);
-        std::cout << "[Wybredny:" << getId()
-                  << "] Kupił 1 szt. '" << nazwaTowaru
-                  << "' za " << cena << "\n";
-    } else {
-        std::cout << "[Wybredny:" << getId()
-                  << "] Nie stać mnie na najdroższe!\n";
+
+    void zglos(const ZdarzenieHandlowe& z) {
+        if (m_odbiorca == nullptr) {
+            return;
+        }
+        // pełna kolejka - czekamy, aż wątek dziennika zrobi miejsce
+        while (!m_kolejka.wstaw(z)) {
+            std::this_thread::yield();
+        }
     }
-}
 
-void KupujacyDetalista::kup(const std::string& nazwaTowaru, Gielda* g)
-{
-    std::vector<Oferta*> oferty = g->znajdzOferty(nazwaTowaru);
-    if (oferty.empty()) {
-        std::cout << "[Detalista:" << getId()
-                  << "] Brak ofert na " << nazwaTowaru << "\n";
-        return;
+    // Czeka, aż odbiorca dostanie wszystko, co dotąd zgłoszono
+    void oproznij() {
+        if (m_odbiorca == nullptr) {
+            return;
+        }
+        while (m_obsluzone.load(std::memory_order_acquire) != m_kolejka.wstawione()) {
+            std::this_thread::yield();
+        }
     }
-    // Sortujemy rosnąco po cenie (bez <algorithm>): proste bąbelkowanie
-    for (std::size_t i = 0; i < oferty.size(); i++) {
-        for (std::size_t j = 0; j + 1 < oferty.size() - i; j++) {
-            if (oferty[j]->getCena() > oferty[j+1]->getCena()) {
-                Oferta* temp = oferty[j];
-                oferty[j] = oferty[j+1];
-                oferty[j+1] = temp;
+
+private:
+    void petla() {
+        ZdarzenieHandlowe z;
+        for (;;) {
+            // flagę czytamy przed opróżnieniem kolejki - nic zgłoszonego przed
+            // zatrzymaniem nie zostanie pominięte
+            bool koniec = m_koniec.load(std::memory_order_acquire);
+            while (m_kolejka.pobierz(z)) {
+                m_odbiorca->odbierz(z);
+                m_obsluzone.fetch_add(1, std::memory_order_release);
             }
+            if (koniec) {
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
         }
     }
-    // Kupujemy po 1 sztuce od najtańszej do najdroższej, dopóki starcza budżet
-    bool kupilCos = false;
-    for (std::size_t i = 0; i < oferty.size(); i++) {
-        Oferta* of = oferty[i];
-        double cena = of->getCena();
-        if (cena <= getBudzet() && of->getLiczbaSztuk() > 0) {
-            zmniejszBudzet(cena);
-            of->sprzedajSztuki(1);
-            std::cout << "[Detalista:" << getId()
-                      << "] Kupił 1 szt. '" << nazwaTowaru
-                      << "' za " << cena << "\n";
-            kupilCos = true;
+
+    void zatrzymaj() {
+        if (m_watek.joinable()) {
+            m_koniec.store(true, std::memory_order_release);
+            m_watek.join();
         }
     }
-    if (!kupilCos) {
-        std::cout << "[Detalista:" << getId()
-                  << "] Nic nie kupiłem (za drogo).\n";
-    }
-}
 
-// -----------------------------------------------------------
+    OdbiorcaZdarzen*                          m_odbiorca;
+    KolejkaBezBlokad<ZdarzenieHandlowe, 4096> m_kolejka;
+    std::thread                               m_watek;
+    std::atomic<bool>                         m_koniec;
+    std::atomic<std::size_t>                  m_obsluzone;
+};
+
+#else
+
+// GIELDA_BEZ_ZDARZEN: dziennik bez kolejki i wątku, zglos() jest puste
+// i znika po kompilacji razem z przygotowaniem zdarzenia
+class DziennikZdarzen {
+public:
+    void ustawOdbiorce(OdbiorcaZdarzen* odbiorca) { delete odbiorca; }
+    void zglos(const ZdarzenieHandlowe&)           {}
+    void oproznij()                                {}
+};
+
+#endif
+
+// -----------------------------------------------------------
+//   Klasa Gielda
+// -----------------------------------------------------------
+
+class Gielda {
+public:
+    Gielda() {
+        // Inicjalizujemy generator liczb pseudolosowych
+        std::random_device rd;
+        m_gen.seed(rd());
+    }
+
+    // Sprzedających, kupujących i oferty zwalniają pule (blok po bloku)
+    ~Gielda() {
+    }
+
+    // uniemożliwiamy kopiowanie Gieldy
+    Gielda(const Gielda&) = delete;
+    Gielda& operator=(const Gielda&) = delete;
+
+    // Uczestnicy powstają w pulach giełdy - giełda jest ich właścicielem,
+    // a zwrócone wskaźniki są ważne przez cały czas jej życia
+    Sprzedajacy* utworzSprzedajacego(const std::string& id) {
+        int nr = static_cast<int>(m_pulaSprzedajacych.rozmiar());
+        int symbol = m_uczestnicy.internuj(id);
+        Sprzedajacy* s = m_pulaSprzedajacych.utworz(m_uczestnicy.nazwa(symbol), symbol, this, nr);
+        zapamietaj(m_sprzedajacyWgSymbolu, symbol, s);
+        return s;
+    }
+
+    // T - jedna ze strategii (KupujacyEkonomiczny, KupujacyWybredny, KupujacyDetalista)
+    template<typename T, typename... Argumenty>
+    T* utworzKupujacego(const std::string& id, double budzet, Argumenty&&... argumenty) {
+        int symbol = m_uczestnicy.internuj(id);
+        T* k = std::get<PulaObiektow<T>>(m_puleKupujacych)
+            .utworz(m_uczestnicy.nazwa(symbol), symbol, budzet, std::forward<Argumenty>(argumenty)...);
+        m_kupujacy.push_back(k);
+        zapamietaj(m_kupujacyWgSymbolu, symbol, static_cast<Kupujacy*>(k));
+        return k;
+    }
+
+    // Uczestnik o danym id (ostatnio utworzony, gdy id się powtarza) albo nullptr
+    Sprzedajacy* znajdzSprzedajacego(std::string_view id) const {
+        return znajdz(m_sprzedajacyWgSymbolu, m_uczestnicy.znajdz(id));
+    }
+
+    Kupujacy* znajdzKupujacego(std::string_view id) const {
+        return znajdz(m_kupujacyWgSymbolu, m_uczestnicy.znajdz(id));
+    }
+
+    // Uczestnicy w kolejności utworzenia (np. po wczytaniu migawki)
+    std::size_t liczbaSprzedajacych() const   { return m_pulaSprzedajacych.rozmiar(); }
+    Sprzedajacy* sprzedajacy(std::size_t nr) { return &m_pulaSprzedajacych[nr]; }
+    std::size_t liczbaKupujacych() const      { return m_kupujacy.size(); }
+    Kupujacy* kupujacy(std::size_t nr)        { return m_kupujacy[nr]; }
+
+    Oferta* wystawOferte(Sprzedajacy* s, const std::string& nazwaTowaru, double cena, int liczbaSztuk) {
+        return wystawOferte(s, przygotujTowar(nazwaTowaru), cena, liczbaSztuk);
+    }
+
+    // idTowaru - z przygotujTowar
+    Oferta* wystawOferte(Sprzedajacy* s, int idTowaru, double cena, int liczbaSztuk) {
+        return utworzOferte(m_kolumny.dodaj(cena, liczbaSztuk, idTowaru, s->getNr()));
+    }
+
+    // Id towaru do wystawiania ofert - nieznana nazwa dostaje id i pustą księgę.
+    // Tylko dla sprzedających: dopisanie towaru może przenieść wektor ksiąg.
+    int przygotujTowar(std::string_view nazwaTowaru) {
+        int idTowaru = m_towary.internuj(nazwaTowaru);
+        if (static_cast<std::size_t>(idTowaru) >= m_ksiegi.size()) {
+            m_ksiegi.resize(idTowaru + 1);
+        }
+        return idTowaru;
+    }
+
+    // Id towaru do zakupów - niczego nie dopisuje; BRAK, gdy nikt go nie wystawił.
+    // Kto kupuje ten sam towar wiele razy, pyta o id raz i dalej używa id.
+    int znajdzTowar(std::string_view nazwaTowaru) const {
+        return m_towary.znajdz(nazwaTowaru);
+    }
+
+    // Dla BRAK - nullptr (zakup kończy się zdarzeniem "brak ofert")
+    KsiegaOfert* ksiega(int idTowaru) {
+        return idTowaru == TablicaSymboli::BRAK ? nullptr : &m_ksiegi[idTowaru];
+    }
+    const std::string& nazwaTowaru(int idTowaru) { return m_towary.nazwa(idTowaru); }
+
+    // Księga danego towaru albo nullptr, jeśli nikt go nigdy nie wystawił
+    KsiegaOfert* znajdzKsiege(const std::string& nazwaTowaru) {
+        return ksiega(znajdzTowar(nazwaTowaru));
+    }
+
+    // Najtańsza oferta z > 0 sztuk (przy remisie - dodana najwcześniej)
+    Oferta* najtanszaOferta(const std::string& nazwaTowaru) {
+        return najtanszaOferta(znajdzKsiege(nazwaTowaru));
+    }
+
+    Oferta* najtanszaOferta(KsiegaOfert* ksiega) {
+        if (ksiega == nullptr) {
+            return nullptr;
+        }
+        // oferty wyczerpane poza giełdą (sprzedajSztuki wywołane wprost) sprzątamy leniwie
+        while (!ksiega->empty() && ksiega->begin()->second->getLiczbaSztuk() == 0) {
+            ksiega->erase(ksiega->begin());
+        }
+        return ksiega->empty() ? nullptr : ksiega->begin()->second;
+    }
+
+    // Najdroższa oferta z > 0 sztuk (przy remisie - dodana najwcześniej)
+    Oferta* najdrozszaOferta(const std::string& nazwaTowaru) {
+        return najdrozszaOferta(znajdzKsiege(nazwaTowaru));
+    }
+
+    Oferta* najdrozszaOferta(KsiegaOfert* ksiega) {
+        if (ksiega == nullptr) {
+            return nullptr;
+        }
+        while (!ksiega->empty() && std::prev(ksiega->end())->second->getLiczbaSztuk() == 0) {
+            ksiega->erase(std::prev(ksiega->end()));
+        }
+        if (ksiega->empty()) {
+            return nullptr;
+        }
+        // ostatnia pozycja ma > 0 sztuk, więc pętla zawsze coś znajdzie
+        auto it = ksiega->lower_bound(std::prev(ksiega->end())->first);
+        while (it->second->getLiczbaSztuk() == 0) {
+            it = ksiega->erase(it);
+        }
+        return it->second;
+    }
+
+    // Najtańsza / najdroższa oferta z > 0 sztuk na całym rynku albo dla danego
+    // towaru - liczona skanem kolumn, bez ksiąg (przy remisie - wystawiona najwcześniej)
+    Oferta* najtanszaNaRynku()                                { return wiersz(m_kolumny.najtanszy(-1)); }
+    Oferta* najdrozszaNaRynku()                               { return wiersz(m_kolumny.najdrozszy(-1)); }
+    Oferta* najtanszaNaRynku(const std::string& nazwaTowaru)  { return skanuj<false>(nazwaTowaru); }
+    Oferta* najdrozszaNaRynku(const std::string& nazwaTowaru) { return skanuj<true>(nazwaTowaru); }
+
+    // Sprzedaż przez giełdę: wyczerpana oferta od razu wypada z księgi.
+    // Zwraca false, gdy w ofercie nie ma już tylu sztuk.
+    bool sprzedajZOferty(Oferta* of, int ile) {
+        if (!of->zarezerwujSztuki(ile)) {
+            return false;
+        }
+        if (of->getLiczbaSztuk() == 0) {
+            usunZKsiegi(of);
+        }
+        return true;
+    }
+
+    // Zwraca wszystkie oferty na dany towar, w których jest > 0 sztuk,
+    // posortowane rosnąco po cenie
+    std::vector<Oferta*> znajdzOferty(const std::string& nazwaTowaru) {
+        return znajdzOferty(znajdzKsiege(nazwaTowaru));
+    }
+
+    std::vector<Oferta*> znajdzOferty(KsiegaOfert* ksiega) {
+        std::vector<Oferta*> wynik;
+        if (ksiega == nullptr) {
+            return wynik;
+        }
+        wynik.reserve(ksiega->size());
+        for (auto& pozycja : *ksiega) {
+            if (pozycja.second->getLiczbaSztuk() > 0) {
+                wynik.push_back(pozycja.second);
+            }
+        }
+        return wynik;
+    }
+
+    // Kupujący kupuje towar -> wywołujemy polimorficzną metodę kup(...)
+    void kupTowar(Kupujacy* k, const std::string& nazwaTowaru) {
+        k->kup(nazwaTowaru, this);
+    }
+
+    // To samo dla id ze znajdzTowar - bez szukania nazwy
+    void kupTowar(Kupujacy* k, int idTowaru) {
+        k->kupZKsiegi(ksiega(idTowaru), idTowaru, this);
+    }
+
+    // Zakupy wielu kupujących tego samego towaru w jednej turze.
+    // Księgę szukamy raz i przechodzimy ją jednym przebiegiem: granice
+    // najtańszej i najdroższej oferty nie cofają się między kupującymi,
+    // a wyczerpane oferty wypadają z księgi hurtem na końcu tury.
+    // Kupujący są obsługiwani dokładnie w kolejności z tablicy - wynik
+    // jest taki sam jak przy kolejnych wywołaniach kupTowar.
+    void kupTowarGrupowo(Kupujacy* const* kupujacy, std::size_t ile, const std::string& nazwaTowaru) {
+        kupTowarGrupowo(kupujacy, ile, znajdzTowar(nazwaTowaru));
+    }
+
+    void kupTowarGrupowo(Kupujacy* const* kupujacy, std::size_t ile, int idTowaru) {
+        PrzebiegKsiegi przebieg(ksiega(idTowaru));
+        for (std::size_t i = 0; i < ile; i++) {
+            kupujacy[i]->kupWPrzebiegu(przebieg, idTowaru, this);
+        }
+    }
+
+    void kupTowarGrupowo(const std::vector<Kupujacy*>& kupujacy, const std::string& nazwaTowaru) {
+        kupTowarGrupowo(kupujacy.data(), kupujacy.size(), nazwaTowaru);
+    }
+
+    // idTowaru - ze znajdzTowar (BRAK - zakup bez ofert)
+    struct ZlecenieKupna {
+        Kupujacy*   kupujacy;
+        int         idTowaru;
+    };
+
+    // Tryb współbieżny: zlecenia dzielimy na shardy wg id towaru i każdy shard
+    // obsługuje osobny wątek. Księga towaru należy do jednego wątku, więc nie
+    // wymaga blokad; sztuki w ofertach i budżety kupujących (jeden kupujący może
+    // trafić do kilku shardów) są pobierane atomowo.
+    // W obrębie towaru zlecenia wykonują się w kolejności z wektora.
+    void kupTowarRownolegle(const std::vector<ZlecenieKupna>& zlecenia, unsigned liczbaWatkow) {
+        if (liczbaWatkow == 0) {
+            liczbaWatkow = 1;
+        }
+        // id towarów ustalono przed wywołaniem (znajdzTowar) - wątki
+        // tylko czytają tablicę symboli i wektor ksiąg
+        std::vector<std::vector<std::size_t>>  shardy(liczbaWatkow);
+        for (std::size_t i = 0; i < zlecenia.size(); i++) {
+            int idTowaru = zlecenia[i].idTowaru;
+            shardy[idTowaru == TablicaSymboli::BRAK ? 0 : idTowaru % liczbaWatkow].push_back(i);
+        }
+
+        std::vector<std::thread> watki;
+        for (unsigned w = 0; w < liczbaWatkow; w++) {
+            if (shardy[w].empty()) {
+                continue;
+            }
+            watki.emplace_back([this, w, &zlecenia, &shardy]() {
+                for (std::size_t i : shardy[w]) {
+                    int idTowaru = zlecenia[i].idTowaru;
+                    zlecenia[i].kupujacy->kupZKsiegi(ksiega(idTowaru), idTowaru, this);
+                }
+            });
+        }
+        for (std::size_t i = 0; i < watki.size(); i++) {
+            watki[i].join();
+        }
+    }
+
+    // Odbiorca zdarzeń handlowych (giełda przejmuje go na własność).
+    // Domyślnie nie ma żadnego - zakupy nic nie wypisują.
+    void ustawOdbiorceZdarzen(OdbiorcaZdarzen* odbiorca) {
+        m_dziennik.ustawOdbiorce(odbiorca);
+    }
+
+    void zglos(const ZdarzenieHandlowe& z) {
+        m_dziennik.zglos(z);
+    }
+
+    // Czeka, aż odbiorca dostanie wszystkie dotychczasowe zdarzenia
+    void oproznijZdarzenia() {
+        m_dziennik.oproznij();
+    }
+
+    // Prosty wypis stanu giełdy
+    void wypiszStan() {
+        // najpierw komunikaty z zakupów, żeby nie wymieszały się ze stanem
+        oproznijZdarzenia();
+        std::cout << "\n=== STAN GIELDY ===\n";
+        // pula trzyma oferty w kolejności wystawienia, ciągłymi blokami
+        for (std::size_t i = 0; i < m_pulaOfert.rozmiar(); i++) {
+            const Oferta& of = m_pulaOfert[i];
+            std::cout << "Towar: " << of.getNazwaTowaru()
+                      << ", cena: " << of.getCena()
+                      << ", sztuk: " << of.getLiczbaSztuk()
+                      << ", sprzedajacy: " << of.getSprzedajacy()->getId()
+                      << "\n";
+        }
+        std::cout << "====================\n";
+    }
+
+    // Migawka stanu: towary, uczestnicy (z budżetami) i oferty w jednym pliku
+    // binarnym. wczytajStan działa tylko na pustej giełdzie - plik jest
+    // mapowany do pamięci, a kolumny ofert kopiowane wprost do KolumnyOfert.
+    // Stan powstaje w osobnej giełdzie i jest przejmowany dopiero, gdy cały
+    // plik okazał się poprawny - po błędzie giełda zostaje pusta.
+    // Obie zwracają false (i wypisują błąd), gdy się nie uda.
+    bool zapiszStan(const char* plik);
+    bool wczytajStan(const char* plik);
+
+    // Potrzebny np. w strategiach losowych (nie używamy w tym przykładzie)
+    std::mt19937& getGen() { return m_gen; }
+
+private:
+    template<typename T>
+    static void zapamietaj(std::vector<T*>& wgSymbolu, int symbol, T* uczestnik) {
+        if (static_cast<std::size_t>(symbol) >= wgSymbolu.size()) {
+            wgSymbolu.resize(symbol + 1, nullptr);
+        }
+        wgSymbolu[symbol] = uczestnik;
+    }
+
+    template<typename T>
+    static T* znajdz(const std::vector<T*>& wgSymbolu, int symbol) {
+        if (symbol == TablicaSymboli::BRAK || static_cast<std::size_t>(symbol) >= wgSymbolu.size()) {
+            return nullptr;
+        }
+        return wgSymbolu[symbol];
+    }
+
+    // Oferta dla gotowego wiersza kolumn - wiersz ma ten sam numer co oferta w puli
+    Oferta* utworzOferte(std::size_t wiersz) {
+        int idTowaru = m_kolumny.idTowaru(wiersz);
+        Oferta* o = m_pulaOfert.utworz(m_towary.nazwa(idTowaru), idTowaru, m_kolumny.cena(wiersz),
+                                       m_kolumny.sztuki(wiersz),
+                                       &m_pulaSprzedajacych[m_kolumny.idSprzedajacego(wiersz)],
+                                       static_cast<int>(wiersz));
+        if (o->getLiczbaSztuk() <= 0) {
+            return o;
+        }
+        // multimap wstawia za ofertami o tej samej cenie - zachowujemy kolejność dodania
+        m_ksiegi[idTowaru].emplace(o->getCena(), o);
+        return o;
+    }
+
+    // Przejmuje stan innej giełdy (dziennik i generator zostają własne)
+    void zamien(Gielda& inna) {
+        m_towary.zamien(inna.m_towary);
+        m_uczestnicy.zamien(inna.m_uczestnicy);
+        m_pulaSprzedajacych.zamien(inna.m_pulaSprzedajacych);
+        std::get<0>(m_puleKupujacych).zamien(std::get<0>(inna.m_puleKupujacych));
+        std::get<1>(m_puleKupujacych).zamien(std::get<1>(inna.m_puleKupujacych));
+        std::get<2>(m_puleKupujacych).zamien(std::get<2>(inna.m_puleKupujacych));
+        m_kupujacy.swap(inna.m_kupujacy);
+        m_sprzedajacyWgSymbolu.swap(inna.m_sprzedajacyWgSymbolu);
+        m_kupujacyWgSymbolu.swap(inna.m_kupujacyWgSymbolu);
+        m_pulaOfert.zamien(inna.m_pulaOfert);
+        m_kolumny.zamien(inna.m_kolumny);
+        m_ksiegi.swap(inna.m_ksiegi);
+        for (std::size_t i = 0; i < m_pulaSprzedajacych.rozmiar(); i++) {
+            m_pulaSprzedajacych[i].m_gielda = this;
+        }
+        for (std::size_t i = 0; i < inna.m_pulaSprzedajacych.rozmiar(); i++) {
+            inna.m_pulaSprzedajacych[i].m_gielda = &inna;
+        }
+    }
+
+    Oferta* wiersz(std::ptrdiff_t i) {
+        return i < 0 ? nullptr : &m_pulaOfert[static_cast<std::size_t>(i)];
+    }
+
+    template<bool Max>
+    Oferta* skanuj(const std::string& nazwaTowaru) {
+        int idTowaru = m_towary.znajdz(nazwaTowaru);
+        if (idTowaru == TablicaSymboli::BRAK) {
+            return nullptr;
+        }
+        return wiersz(Max ? m_kolumny.najdrozszy(idTowaru) : m_kolumny.najtanszy(idTowaru));
+    }
+
+    void usunZKsiegi(Oferta* of) {
+        KsiegaOfert* ksiega = &m_ksiegi[of->getIdTowaru()];
+        auto zakres = ksiega->equal_range(of->getCena());
+        for (auto it = zakres.first; it != zakres.second; ++it) {
+            if (it->second == of) {
+                ksiega->erase(it);
+                return;
+            }
+        }
+    }
+
+    // tablice symboli przed pulami - oferty i uczestnicy wskazują na ich napisy
+    TablicaSymboli            m_towary;     // nazwa towaru -> id księgi
+    TablicaSymboli            m_uczestnicy; // id sprzedających i kupujących
+    PulaObiektow<Sprzedajacy> m_pulaSprzedajacych;
+    std::tuple<PulaObiektow<KupujacyEkonomiczny>,
+               PulaObiektow<KupujacyWybredny>,
+               PulaObiektow<KupujacyDetalista>> m_puleKupujacych;
+    std::vector<Kupujacy*>    m_kupujacy;   // wszyscy kupujący w kolejności utworzenia
+    std::vector<Sprzedajacy*> m_sprzedajacyWgSymbolu; // indeksowane symbolem uczestnika
+    std::vector<Kupujacy*>    m_kupujacyWgSymbolu;
+    PulaObiektow<Oferta>      m_pulaOfert;  // wszystkie oferty (własność giełdy)
+    KolumnyOfert              m_kolumny;    // te same oferty kolumnami (cena, sztuki, ...)
+    std::vector<KsiegaOfert>  m_ksiegi;     // indeksowane id towaru
+    std::mt19937 m_gen;
+    DziennikZdarzen           m_dziennik;   // ostatni - znika przed kupującymi, o których pisze
+};
+
+// -----------------------------------------------------------
+//   Migawka stanu giełdy
+// -----------------------------------------------------------
+// Układ pliku (liczby w kolejności bajtów maszyny, która go zapisała):
+//   NaglowekMigawki
+//   napisy: towary, potem uczestnicy - każdy jako uint32 długość + bajty
+//   sprzedający: uint32 symbol uczestnika
+//   kupujący:    RekordKupujacego
+//   oferty:      cztery kolumny po `ofert` pozycji, w kolejności wystawienia:
+//                double ceny, int32 sztuki, int32 idTowaru, int32 nrSprzedajacego
+// Id towarów i uczestników to po prostu numery napisów, więc po wczytaniu
+// są takie same jak przy zapisie.
+
+struct NaglowekMigawki {
+    char          znacznik[8];   // "GIELDA02"
+    std::uint32_t towarow;
+    std::uint32_t uczestnikow;
+    std::uint32_t sprzedajacych;
+    std::uint32_t kupujacych;
+    std::uint64_t ofert;
+};
+
+struct RekordKupujacego {
+    double        budzet;
+    std::uint32_t symbol;
+    std::int32_t  limitSztuk;    // tylko Detalista
+    std::uint8_t  rodzaj;        // RodzajKupujacego
+    std::uint8_t  wyrownanie[7];
+};
+
+static_assert(sizeof(int) == sizeof(std::int32_t), "kolumny ofert w migawce to int32");
+
+static const char ZNACZNIK_MIGAWKI[8] = { 'G', 'I', 'E', 'L', 'D', 'A', '0', '2' };
+
+// Czytanie ze zmapowanego pliku z kontrolą końca danych
+class CzytnikMigawki {
+public:
+    CzytnikMigawki(const char* dane, std::size_t rozmiar)
+        : m_poz(dane), m_koniec(dane + rozmiar)
+    {
+    }
+
+    template<typename T>
+    bool czytaj(T& x) {
+        if (static_cast<std::size_t>(m_koniec - m_poz) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&x, m_poz, sizeof(T));
+        m_poz += sizeof(T);
+        return true;
+    }
+
+    // Napis pokazuje wprost na bajty w pliku
+    bool czytajNapis(std::string_view& napis) {
+        std::uint32_t dlugosc;
+        if (!czytaj(dlugosc) || static_cast<std::size_t>(m_koniec - m_poz) < dlugosc) {
+            return false;
+        }
+        napis = std::string_view(m_poz, dlugosc);
+        m_poz += dlugosc;
+        return true;
+    }
+
+    // Kolumna n wartości typu T - zwraca wskaźnik na jej bajty w pliku
+    // (bez wyrównania, więc czytamy ją tylko przez memcpy)
+    template<typename T>
+    bool czytajKolumne(std::uint64_t n, const char*& kolumna) {
+        std::size_t reszta = static_cast<std::size_t>(m_koniec - m_poz);
+        if (n > reszta / sizeof(T)) {
+            return false;
+        }
+        kolumna = m_poz;
+        m_poz += n * sizeof(T);
+        return true;
+    }
+
+    bool koniec() const { return m_poz == m_koniec; }
+
+private:
+    const char* m_poz;
+    const char* m_koniec;
+};
+
+bool Gielda::zapiszStan(const char* plik)
+{
+    std::vector<char> bufor;
+    auto dopisz = [&bufor](const void* dane, std::size_t ile) {
+        const char* p = static_cast<const char*>(dane);
+        bufor.insert(bufor.end(), p, p + ile);
+    };
+    auto dopiszNapis = [&dopisz](const std::string& napis) {
+        std::uint32_t dlugosc = static_cast<std::uint32_t>(napis.size());
+        dopisz(&dlugosc, sizeof(dlugosc));
+        dopisz(napis.data(), napis.size());
+    };
+
+    NaglowekMigawki nagl;
+    std::memcpy(nagl.znacznik, ZNACZNIK_MIGAWKI, sizeof(nagl.znacznik));
+    nagl.towarow       = static_cast<std::uint32_t>(m_towary.rozmiar());
+    nagl.uczestnikow   = static_cast<std::uint32_t>(m_uczestnicy.rozmiar());
+    nagl.sprzedajacych = static_cast<std::uint32_t>(m_pulaSprzedajacych.rozmiar());
+    nagl.kupujacych    = static_cast<std::uint32_t>(m_kupujacy.size());
+    nagl.ofert         = m_pulaOfert.rozmiar();
+    bufor.reserve(sizeof(nagl) + nagl.kupujacych * sizeof(RekordKupujacego)
+                  + nagl.ofert * (sizeof(double) + 3 * sizeof(std::int32_t)));
+    dopisz(&nagl, sizeof(nagl));
+
+    for (std::size_t i = 0; i < m_towary.rozmiar(); i++) {
+        dopiszNapis(m_towary.nazwa(static_cast<int>(i)));
+    }
+    for (std::size_t i = 0; i < m_uczestnicy.rozmiar(); i++) {
+        dopiszNapis(m_uczestnicy.nazwa(static_cast<int>(i)));
+    }
+    for (std::size_t i = 0; i < m_pulaSprzedajacych.rozmiar(); i++) {
+        std::uint32_t symbol = static_cast<std::uint32_t>(m_pulaSprzedajacych[i].getSymbol());
+        dopisz(&symbol, sizeof(symbol));
+    }
+    for (std::size_t i = 0; i < m_kupujacy.size(); i++) {
+        const Kupujacy* k = m_kupujacy[i];
+        RekordKupujacego rek = {};
+        rek.budzet = k->getBudzet();
+        rek.symbol = static_cast<std::uint32_t>(k->getSymbol());
+        rek.rodzaj = static_cast<std::uint8_t>(k->rodzaj());
+        if (k->rodzaj() == RodzajKupujacego::DETALISTA) {
+            rek.limitSztuk = static_cast<const KupujacyDetalista*>(k)->getLimitSztuk();
+        }
+        dopisz(&rek, sizeof(rek));
+    }
+    // oferty kolumnami - tak jak leżą w KolumnyOfert
+    for (std::size_t i = 0; i < m_kolumny.rozmiar(); i++) {
+        double cena = m_kolumny.cena(i);
+        dopisz(&cena, sizeof(cena));
+    }
+    for (std::size_t i = 0; i < m_pulaOfert.rozmiar(); i++) {
+        std::int32_t sztuki = m_pulaOfert[i].getLiczbaSztuk();
+        dopisz(&sztuki, sizeof(sztuki));
+    }
+    for (std::size_t i = 0; i < m_kolumny.rozmiar(); i++) {
+        std::int32_t idTowaru = m_kolumny.idTowaru(i);
+        dopisz(&idTowaru, sizeof(idTowaru));
+    }
+    for (std::size_t i = 0; i < m_kolumny.rozmiar(); i++) {
+        std::int32_t nrSprzedajacego = m_kolumny.idSprzedajacego(i);
+        dopisz(&nrSprzedajacego, sizeof(nrSprzedajacego));
+    }
+
+    std::FILE* f = std::fopen(plik, "wb");
+    if (f == nullptr) {
+        std::cerr << "[Gielda] Nie można otworzyć pliku migawki: " << plik << "\n";
+        return false;
+    }
+    bool ok = std::fwrite(bufor.data(), 1, bufor.size(), f) == bufor.size();
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok) {
+        std::cerr << "[Gielda] Błąd zapisu migawki: " << plik << "\n";
+    }
+    return ok;
+}
+
+bool Gielda::wczytajStan(const char* plik)
+{
+    if (m_towary.rozmiar() != 0 || m_uczestnicy.rozmiar() != 0 || m_pulaOfert.rozmiar() != 0) {
+        std::cerr << "[Gielda] Migawkę można wczytać tylko do pustej giełdy!\n";
+        return false;
+    }
+    int fd = ::open(plik, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[Gielda] Nie można otworzyć pliku migawki: " << plik << "\n";
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        std::cerr << "[Gielda] Pusty lub nieczytelny plik migawki: " << plik << "\n";
+        return false;
+    }
+    std::size_t rozmiar = static_cast<std::size_t>(st.st_size);
+    void* mapa = ::mmap(nullptr, rozmiar, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapa == MAP_FAILED) {
+        std::cerr << "[Gielda] Nie można zmapować pliku migawki: " << plik << "\n";
+        return false;
+    }
+    ::madvise(mapa, rozmiar, MADV_SEQUENTIAL);
+
+    // wszystko powstaje w nowa; ta giełda zmienia się dopiero na końcu
+    Gielda nowa;
+    CzytnikMigawki czytnik(static_cast<const char*>(mapa), rozmiar);
+    NaglowekMigawki nagl;
+    bool ok = czytnik.czytaj(nagl)
+              && std::memcmp(nagl.znacznik, ZNACZNIK_MIGAWKI, sizeof(nagl.znacznik)) == 0;
+
+    std::string_view napis;
+    for (std::uint32_t i = 0; ok && i < nagl.towarow; i++) {
+        ok = czytnik.czytajNapis(napis);
+        if (ok) {
+            nowa.przygotujTowar(napis);
+        }
+    }
+    for (std::uint32_t i = 0; ok && i < nagl.uczestnikow; i++) {
+        ok = czytnik.czytajNapis(napis);
+        if (ok) {
+            nowa.m_uczestnicy.internuj(napis);
+        }
+    }
+    // napisy w tablicach są różne, więc ich liczba musi się zgadzać z nagłówkiem
+    ok = ok && nowa.m_towary.rozmiar() == nagl.towarow && nowa.m_uczestnicy.rozmiar() == nagl.uczestnikow;
+
+    for (std::uint32_t i = 0; ok && i < nagl.sprzedajacych; i++) {
+        std::uint32_t symbol;
+        ok = czytnik.czytaj(symbol) && symbol < nagl.uczestnikow;
+        if (ok) {
+            nowa.utworzSprzedajacego(nowa.m_uczestnicy.nazwa(static_cast<int>(symbol)));
+        }
+    }
+    for (std::uint32_t i = 0; ok && i < nagl.kupujacych; i++) {
+        RekordKupujacego rek;
+        // jak w StrumienZlecen: skończony budżet >= 0 i limit >= 0
+        ok = czytnik.czytaj(rek) && rek.symbol < nagl.uczestnikow
+             && std::isfinite(rek.budzet) && rek.budzet >= 0.0 && rek.limitSztuk >= 0;
+        if (!ok) {
+            break;
+        }
+        const std::string& id = nowa.m_uczestnicy.nazwa(static_cast<int>(rek.symbol));
+        switch (static_cast<RodzajKupujacego>(rek.rodzaj)) {
+        case RodzajKupujacego::EKONOMICZNY:
+            nowa.utworzKupujacego<KupujacyEkonomiczny>(id, rek.budzet);
+            break;
+        case RodzajKupujacego::WYBREDNY:
+            nowa.utworzKupujacego<KupujacyWybredny>(id, rek.budzet);
+            break;
+        case RodzajKupujacego::DETALISTA:
+            nowa.utworzKupujacego<KupujacyDetalista>(id, rek.budzet, static_cast<int>(rek.limitSztuk));
+            break;
+        default:
+            ok = false;
+            break;
+        }
+    }
+
+    const char* ceny = nullptr;
+    const char* sztuki = nullptr;
+    const char* idTowarow = nullptr;
+    const char* nrSprzedajacych = nullptr;
+    ok = ok && czytnik.czytajKolumne<double>(nagl.ofert, ceny)
+            && czytnik.czytajKolumne<std::int32_t>(nagl.ofert, sztuki)
+            && czytnik.czytajKolumne<std::int32_t>(nagl.ofert, idTowarow)
+            && czytnik.czytajKolumne<std::int32_t>(nagl.ofert, nrSprzedajacych)
+            && czytnik.koniec();
+    // przed skopiowaniem kolumn sprawdzamy każdy wiersz: skończona cena >= 0
+    // (NaN zepsułby porządek księgi), sztuki >= 0 (wyczerpane oferty też są
+    // w migawce) i odwołania do towarów i sprzedających
+    for (std::uint64_t i = 0; ok && i < nagl.ofert; i++) {
+        double cena;
+        std::int32_t liczbaSztuk, idTowaru, nrSprzedajacego;
+        std::memcpy(&cena, ceny + i * sizeof(cena), sizeof(cena));
+        std::memcpy(&liczbaSztuk, sztuki + i * sizeof(liczbaSztuk), sizeof(liczbaSztuk));
+        std::memcpy(&idTowaru, idTowarow + i * sizeof(idTowaru), sizeof(idTowaru));
+        std::memcpy(&nrSprzedajacego, nrSprzedajacych + i * sizeof(nrSprzedajacego), sizeof(nrSprzedajacego));
+        ok = std::isfinite(cena) && cena >= 0.0 && liczbaSztuk >= 0
+             && idTowaru >= 0 && static_cast<std::uint32_t>(idTowaru) < nagl.towarow
+             && nrSprzedajacego >= 0 && static_cast<std::uint32_t>(nrSprzedajacego) < nagl.sprzedajacych;
+    }
+    if (ok) {
+        std::size_t pierwszy = nowa.m_kolumny.dodajKolumny(ceny, sztuki, idTowarow, nrSprzedajacych,
+                                                           static_cast<std::size_t>(nagl.ofert));
+        for (std::size_t w = pierwszy; w < nowa.m_kolumny.rozmiar(); w++) {
+            nowa.utworzOferte(w);
+        }
+    }
+    ::munmap(mapa, rozmiar);
+
+    if (!ok) {
+        std::cerr << "[Gielda] Uszkodzony plik migawki: " << plik << "\n";
+        return false;
+    }
+    zamien(nowa);
+    return true;
+}
+
+// -----------------------------------------------------------
+//   Klasa StrumienZlecen (wczytywanie ofert i zakupów z pliku)
+// -----------------------------------------------------------
+// Format CSV - jeden rekord w wierszu (puste wiersze i '#...' są pomijane):
+//   O,<sprzedajacy>,<towar>,<cena>,<sztuk>        oferta (nowy sprzedający powstaje sam)
+//   B,<kupujacy>,<E|W|D>,<budzet>[,<limit>]       nowy kupujący ze strategią
+//   K,<kupujacy>,<towar>                          zakup
+// Wariant binarny: te same rekordy jako RekordBinarnyZlecenia (64 B).
+// Oferta musi mieć > 0 sztuk i cenę >= 0, kupujący budżet >= 0 i limit >= 0
+// (liczby skończone) - inne rekordy są pomijane i liczone jako błędne.
+//
+// Wejście jest czytane paczkami w osobnym wątku, który od razu je parsuje;
+// wątek wywołujący w tym czasie wykonuje na giełdzie rekordy z poprzednich
+// paczek. Paczki krążą między wątkami i są używane wielokrotnie, a napisy
+// w rekordach wskazują wprost na bajty paczki - parsowanie nic nie alokuje.
+
+struct RekordBinarnyZlecenia {
+    char          typ;          // 'O', 'B' albo 'K'
+    char          rodzaj;       // strategia kupującego: 'E', 'W', 'D'
+    std::uint8_t  wyrownanie[2];
+    std::int32_t  liczba;       // sztuk (O) albo limit (B)
+    double        kwota;        // cena (O) albo budżet (B)
+    char          uczestnik[24]; // napisy dopełnione zerami
+    char          towar[24];
+};
+
+static_assert(sizeof(RekordBinarnyZlecenia) == 64, "rekord binarny ma 64 bajty");
+
+class StrumienZlecen {
+public:
+    enum class Format { CSV, BINARNY };
+
+    StrumienZlecen(Gielda* g, Format format)
+        : m_gielda(g), m_format(format), m_rekordow(0), m_blednych(0), m_bladOdczytu(false)
+    {
+    }
+
+    StrumienZlecen(const StrumienZlecen&) = delete;
+    StrumienZlecen& operator=(const StrumienZlecen&) = delete;
+
+    // "-" oznacza standardowe wejście. false - pliku nie da się otworzyć
+    // albo odczyt przerwał błąd wejścia.
+    bool wczytaj(const char* plik) {
+        bool stdin_ = std::strcmp(plik, "-") == 0;
+        std::FILE* f = stdin_ ? stdin : std::fopen(plik, "rb");
+        if (f == nullptr) {
+            std::cerr << "[StrumienZlecen] Nie można otworzyć pliku: " << plik << "\n";
+            return false;
+        }
+        bool ok = wczytaj(f);
+        if (!stdin_) {
+            std::fclose(f);
+        }
+        return ok;
+    }
+
+    // Czyta f do końca; rekordy trafiają na giełdę w kolejności z wejścia.
+    // false - odczyt przerwał błąd wejścia (rekordy sprzed błędu są wykonane).
+    bool wczytaj(std::FILE* f);
+
+    std::size_t rekordow() const { return m_rekordow; }  // wykonane
+    std::size_t blednych() const { return m_blednych; }  // pominięte (błąd formatu lub danych)
+    bool bladOdczytu() const     { return m_bladOdczytu; } // ostatnie wczytaj() nie doszło do końca wejścia
+
+private:
+    static const std::size_t ROZMIAR_PACZKI = 1 << 16;
+    static const std::size_t PACZEK = 4;
+
+    struct Rekord {
+        char             typ;
+        char             rodzaj;
+        int              liczba;
+        double           kwota;
+        std::string_view uczestnik;
+        std::string_view towar;
+    };
+
+    struct Paczka {
+        std::vector<char>   dane;
+        std::vector<Rekord> rekordy;
+        std::size_t         blednych;
+        bool                ostatnia;
+        bool                bladOdczytu;   // tylko w ostatniej paczce
+    };
+
+    void czytajPaczki(std::FILE* f);
+    std::size_t parsuj(Paczka& p, std::size_t dlugosc, bool koniecWejscia);
+    static bool parsujWiersz(std::string_view wiersz, Rekord& r);
+    static bool parsujBinarny(const char* dane, Rekord& r);
+    static bool poprawny(const Rekord& r);
+    void wykonaj(const Rekord& r);
+
+    Gielda*                           m_gielda;
+    Format                            m_format;
+    std::size_t                       m_rekordow;
+    std::size_t                       m_blednych;
+    bool                              m_bladOdczytu;
+    Paczka                            m_paczki[PACZEK];
+    KolejkaBezBlokad<Paczka*, PACZEK> m_wolne;
+    KolejkaBezBlokad<Paczka*, PACZEK> m_pelne;
+};
+
+bool StrumienZlecen::wczytaj(std::FILE* f)
+{
+    m_bladOdczytu = false;
+    for (std::size_t i = 0; i < PACZEK; i++) {
+        m_wolne.wstaw(&m_paczki[i]);
+    }
+    std::thread parser(&StrumienZlecen::czytajPaczki, this, f);
+
+    Paczka* p = nullptr;
+    for (;;) {
+        while (!m_pelne.pobierz(p)) {
+            std::this_thread::yield();
+        }
+        for (std::size_t i = 0; i < p->rekordy.size(); i++) {
+            wykonaj(p->rekordy[i]);
+        }
+        m_blednych += p->blednych;
+        bool ostatnia = p->ostatnia;
+        m_bladOdczytu = p->bladOdczytu;
+        m_wolne.wstaw(p);
+        if (ostatnia) {
+            break;
+        }
+    }
+    parser.join();
+    // przygotowanie do kolejnego wczytaj() - wszystkie paczki wróciły do m_wolne
+    while (m_wolne.pobierz(p)) {
+    }
+    if (m_bladOdczytu) {
+        std::cerr << "[StrumienZlecen] Błąd odczytu wejścia - strumień przerwany\n";
+    }
+    return !m_bladOdczytu;
+}
+
+// Wątek parsera: wczytuje paczkę, dzieli ją na rekordy i oddaje do wykonania.
+// Niepełny rekord z końca paczki przechodzi na początek następnej.
+void StrumienZlecen::czytajPaczki(std::FILE* f)
+{
+    std::vector<char> reszta;
+    bool koniecWejscia = false;
+    while (!koniecWejscia) {
+        Paczka* p = nullptr;
+        while (!m_wolne.pobierz(p)) {
+            std::this_thread::yield();
+        }
+        if (p->dane.size() < reszta.size() + ROZMIAR_PACZKI) {
+            p->dane.resize(reszta.size() + ROZMIAR_PACZKI);
+        }
+        std::copy(reszta.begin(), reszta.end(), p->dane.begin());
+        std::size_t dlugosc = reszta.size()
+                              + std::fread(p->dane.data() + reszta.size(), 1, ROZMIAR_PACZKI, f);
+        // krótszy odczyt to koniec wejścia albo błąd - rozróżnia je dopiero ferror
+        bool blad = std::ferror(f) != 0;
+        koniecWejscia = blad || dlugosc < reszta.size() + ROZMIAR_PACZKI;
+
+        std::size_t zuzyte = parsuj(*p, dlugosc, koniecWejscia);
+        reszta.assign(p->dane.data() + zuzyte, p->dane.data() + dlugosc);
+        p->ostatnia = koniecWejscia;
+        p->bladOdczytu = blad;
+        m_pelne.wstaw(p);
+    }
+}
+
+// Zwraca, ile bajtów paczki zajęły pełne rekordy
+std::size_t StrumienZlecen::parsuj(Paczka& p, std::size_t dlugosc, bool koniecWejscia)
+{
+    p.rekordy.clear();
+    p.blednych = 0;
+    const char* dane = p.dane.data();
+    std::size_t poz = 0;
+    Rekord r;
+    if (m_format == Format::BINARNY) {
+        for (; poz + sizeof(RekordBinarnyZlecenia) <= dlugosc; poz += sizeof(RekordBinarnyZlecenia)) {
+            if (parsujBinarny(dane + poz, r) && poprawny(r)) {
+                p.rekordy.push_back(r);
+            } else {
+                p.blednych++;
+            }
+        }
+        if (koniecWejscia && poz < dlugosc) {
+            p.blednych++;   // ucięty ostatni rekord
+            poz = dlugosc;
+        }
+        return poz;
+    }
+    while (poz < dlugosc) {
+        const void* nl = std::memchr(dane + poz, '\n', dlugosc - poz);
+        if (nl == nullptr && !koniecWejscia) {
+            break;
+        }
+        std::size_t koniec = nl != nullptr ? static_cast<const char*>(nl) - dane : dlugosc;
+        std::string_view wiersz(dane + poz, koniec - poz);
+        if (!wiersz.empty() && wiersz.back() == '\r') {
+            wiersz.remove_suffix(1);
+        }
+        if (!wiersz.empty() && wiersz[0] != '#') {
+            if (parsujWiersz(wiersz, r) && poprawny(r)) {
+                p.rekordy.push_back(r);
+            } else {
+                p.blednych++;
+            }
+        }
+        poz = nl != nullptr ? koniec + 1 : dlugosc;
+    }
+    return poz;
+}
+
+bool StrumienZlecen::parsujWiersz(std::string_view wiersz, Rekord& r)
+{
+    std::string_view pola[5];
+    std::size_t ile = 0;
+    for (;;) {
+        std::size_t przecinek = wiersz.find(',');
+        if (ile == 5) {
+            return false;
+        }
+        pola[ile++] = wiersz.substr(0, przecinek);
+        if (przecinek == std::string_view::npos) {
+            break;
+        }
+        wiersz.remove_prefix(przecinek + 1);
+    }
+    auto liczba = [](std::string_view pole, auto& x) {
+        auto wynik = std::from_chars(pole.data(), pole.data() + pole.size(), x);
+        return wynik.ec == std::errc() && wynik.ptr == pole.data() + pole.size();
+    };
+
+    if (pola[0].size() != 1 || ile < 2 || pola[1].empty()) {
+        return false;
+    }
+    r.typ       = pola[0][0];
+    r.rodzaj    = 0;
+    r.liczba    = 0;
+    r.kwota     = 0.0;
+    r.uczestnik = pola[1];
+    r.towar     = std::string_view();
+    switch (r.typ) {
+    case 'O':
+        r.towar = pola[2];
+        return ile == 5 && !r.towar.empty() && liczba(pola[3], r.kwota) && liczba(pola[4], r.liczba);
+    case 'B':
+        if ((ile != 4 && ile != 5) || pola[2].size() != 1) {
+            return false;
+        }
+        r.rodzaj = pola[2][0];
+        return liczba(pola[3], r.kwota) && (ile == 4 || liczba(pola[4], r.liczba));
+    case 'K':
+        r.towar = pola[2];
+        return ile == 3 && !r.towar.empty();
+    default:
+        return false;
+    }
+}
+
+bool StrumienZlecen::parsujBinarny(const char* dane, Rekord& r)
+{
+    RekordBinarnyZlecenia b;
+    std::memcpy(&b, dane, sizeof(b));
+    r.typ       = b.typ;
+    r.rodzaj    = b.rodzaj;
+    r.liczba    = b.liczba;
+    r.kwota     = b.kwota;
+    // napis zajmuje pole do pierwszego zera (albo całe pole)
+    const char* u = dane + offsetof(RekordBinarnyZlecenia, uczestnik);
+    const char* t = dane + offsetof(RekordBinarnyZlecenia, towar);
+    r.uczestnik = std::string_view(u, strnlen(u, sizeof(b.uczestnik)));
+    r.towar     = std::string_view(t, strnlen(t, sizeof(b.towar)));
+    return (r.typ == 'O' || r.typ == 'B' || r.typ == 'K') && !r.uczestnik.empty()
+           && (r.typ == 'B' || !r.towar.empty());
+}
+
+// Wartości, których giełda nie przyjmie sensownie - sprawdzane dla obu formatów
+bool StrumienZlecen::poprawny(const Rekord& r)
+{
+    switch (r.typ) {
+    case 'O':
+        return r.liczba > 0 && std::isfinite(r.kwota) && r.kwota >= 0.0;
+    case 'B':
+        return r.liczba >= 0 && std::isfinite(r.kwota) && r.kwota >= 0.0;
+    default:
+        return true;
+    }
+}
+
+void StrumienZlecen::wykonaj(const Rekord& r)
+{
+    switch (r.typ) {
+    case 'O': {
+        Sprzedajacy* s = m_gielda->znajdzSprzedajacego(r.uczestnik);
+        if (s == nullptr) {
+            s = m_gielda->utworzSprzedajacego(std::string(r.uczestnik));
+        }
+        m_gielda->wystawOferte(s, m_gielda->przygotujTowar(r.towar), r.kwota, r.liczba);
+        break;
+    }
+    case 'B': {
+        if (m_gielda->znajdzKupujacego(r.uczestnik) != nullptr) {
+            m_blednych++;
+            return;
+        }
+        std::string id(r.uczestnik);
+        if (r.rodzaj == 'E') {
+            m_gielda->utworzKupujacego<KupujacyEkonomiczny>(id, r.kwota);
+        } else if (r.rodzaj == 'W') {
+            m_gielda->utworzKupujacego<KupujacyWybredny>(id, r.kwota);
+        } else if (r.rodzaj == 'D') {
+            m_gielda->utworzKupujacego<KupujacyDetalista>(id, r.kwota, r.liczba);
+        } else {
+            m_blednych++;
+            return;
+        }
+        break;
+    }
+    case 'K': {
+        Kupujacy* k = m_gielda->znajdzKupujacego(r.uczestnik);
+        if (k == nullptr) {
+            m_blednych++;
+            return;
+        }
+        m_gielda->kupTowar(k, m_gielda->znajdzTowar(r.towar));
+        break;
+    }
+    }
+    m_rekordow++;
+}
+
+// -----------------------------------------------------------
+//   Implementacje metod kup(...) w strategiach Kupujacy
+// -----------------------------------------------------------
+
+Oferta* Sprzedajacy::wystawOferte(const std::string& nazwaTowaru, double cena, int liczbaSztuk)
+{
+    return m_gielda->wystawOferte(this, nazwaTowaru, cena, liczbaSztuk);
+}
+
+void Kupujacy::kup(const std::string& nazwaTowaru, Gielda* g)
+{
+    int idTowaru = g->znajdzTowar(nazwaTowaru);
+    kupZKsiegi(g->ksiega(idTowaru), idTowaru, g);
+}
+
+inline void Kupujacy::zglos(Gielda* g, KodZdarzenia kod, int idTowaru, const Oferta* of, int sztuk) const
+{
+#ifndef GIELDA_BEZ_ZDARZEN
+    ZdarzenieHandlowe z;
+    z.kupujacy = this;
+    z.towar    = idTowaru == TablicaSymboli::BRAK ? nullptr : &g->nazwaTowaru(idTowaru);
+    z.cena     = of != nullptr ? of->getCena() : 0.0;
+    z.idOferty = of != nullptr ? of->getNr() : -1;
+    z.idTowaru = idTowaru;
+    z.sztuk    = sztuk;
+    z.kod      = kod;
+    g->zglos(z);
+#else
+    (void)g; (void)kod; (void)idTowaru; (void)of; (void)sztuk;
+#endif
+}
+
+void Kupujacy::kupZKsiegi(KsiegaOfert* ksiega, int idTowaru, Gielda* g)
+{
+    PrzebiegKsiegi przebieg(ksiega);
+    kupWPrzebiegu(przebieg, idTowaru, g);
+}
+
+void KupujacyEkonomiczny::kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g)
+{
+    // Księga jest posortowana po cenie - najtańsza oferta leży na początku
+    Oferta* najtansza = przebieg.najtansza();
+    if (najtansza == nullptr) {
+        zglos(g, KodZdarzenia::BRAK_OFERT, idTowaru);
+        return;
+    }
+    double cena = najtansza->getCena();
+    // Najpierw budżet, potem sztuka - obie rzeczy pobierane atomowo
+    if (sprobujWydac(cena)) {
+        if (przebieg.sprzedaj(najtansza, 1)) {
+            zglos(g, KodZdarzenia::KUPIL, idTowaru, najtansza, 1);
+        } else {
+            zwrocBudzet(cena);
+            zglos(g, KodZdarzenia::BRAK_OFERT, idTowaru);
+        }
+    } else {
+        zglos(g, KodZdarzenia::ZA_DROGO, idTowaru);
+    }
+}
+
+void KupujacyWybredny::kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g)
+{
+    // Najdroższa oferta leży na końcu księgi
+    Oferta* najdrozsza = przebieg.najdrozsza();
+    if (najdrozsza == nullptr) {
+        zglos(g, KodZdarzenia::BRAK_OFERT, idTowaru);
+        return;
+    }
+    double cena = najdrozsza->getCena();
+    // Najpierw budżet, potem sztuka - obie rzeczy pobierane atomowo
+    if (sprobujWydac(cena)) {
+        if (przebieg.sprzedaj(najdrozsza, 1)) {
+            zglos(g, KodZdarzenia::KUPIL, idTowaru, najdrozsza, 1);
+        } else {
+            zwrocBudzet(cena);
+            zglos(g, KodZdarzenia::BRAK_OFERT, idTowaru);
+        }
+    } else {
+        zglos(g, KodZdarzenia::ZA_DROGO, idTowaru);
+    }
+}
+
+void KupujacyDetalista::kupWPrzebiegu(PrzebiegKsiegi& przebieg, int idTowaru, Gielda* g)
+{
+    KursorKsiegi kursor(przebieg);
+    if (kursor.biezaca() == nullptr) {
+        zglos(g, KodZdarzenia::BRAK_OFERT, idTowaru);
+        return;
+    }
+    // Idziemy od najtańszej do najdroższej, dopóki starcza budżetu
+    // (ceny rosną, więc pierwsza za droga oferta kończy zakupy)
+    bool kupilCos = false;
+    int pozostalo = m_limitSztuk;
+    for (Oferta* of = kursor.biezaca(); of != nullptr; of = kursor.biezaca()) {
+        double cena = of->getCena();
+        // decyzję podejmujemy na jednym odczycie budżetu i sztuk
+        double budzet = getBudzet();
+        int sztuk = of->getLiczbaSztuk();
+        if (sztuk == 0) {
+            continue;   // wyczerpana po biezaca() - kursor ją teraz ominie
+        }
+        if (cena > budzet) {
+            break;
+        }
+        int ile = 1;
+        if (m_limitSztuk > 0) {
+            ile = sztuk < pozostalo ? sztuk : pozostalo;
+            // darmowej oferty nie ma przez co dzielić - bierzemy, ile się da
+            if (cena > 0.0) {
+                // iloraz przycinamy jeszcze na double - rzutowanie większego na int to UB
+                ile = static_cast<int>(std::min<double>(budzet / cena, ile));
+                // dzielenie na double potrafi zaokrąglić w górę
+                while (ile > 0 && ile * cena > budzet) {
+                    ile--;
+                }
+            }
+        }
+        if (ile <= 0) {
+            break;
+        }
+        // Budżet lub sztuki mógł w międzyczasie zabrać inny wątek - wtedy
+        // oddajemy to, co pobraliśmy, i oceniamy bieżącą ofertę od nowa.
+        // Ponawiamy tylko, gdy stan naprawdę się zmienił - inaczej nie ma
+        // szans na inny wynik i kończymy zakupy.
+        if (!sprobujWydac(ile * cena)) {
+            if (getBudzet() == budzet) {
+                break;
+            }
+            continue;
+        }
+        if (!kursor.sprzedajIDalej(ile)) {
+            zwrocBudzet(ile * cena);
+            if (of->getLiczbaSztuk() == sztuk) {
+                break;
+            }
+            continue;
+        }
+        zglos(g, KodZdarzenia::KUPIL, idTowaru, of, ile);
+        kupilCos = true;
+        if (m_limitSztuk > 0) {
+            pozostalo -= ile;
+            if (pozostalo == 0) {
+                break;
+            }
+        }
+    }
+    if (!kupilCos) {
+        zglos(g, KodZdarzenia::ZA_DROGO, idTowaru);
+    }
+}
+
+// -----------------------------------------------------------
 //   Funkcja main - przykładowe użycie
 // -----------------------------------------------------------
 int main()
 {
-    // 1) Tworzymy giełdę
+    // 1) Tworzymy giełdę; komunikaty o zakupach wypisuje odbiorca tekstowy
     Gielda* g = new Gielda();
+    g->ustawOdbiorceZdarzen(new OdbiorcaTekstowy(std::cout));
 
-    // 2) Dodajemy sprzedających
-    Sprzedajacy* s1 = new Sprzedajacy("Sprzedawca_1");
-    Sprzedajacy* s2 = new Sprzedajacy("Sprzedawca_2");
-    g->zarejestrujSprzedajacego(s1);
-    g->zarejestrujSprzedajacego(s2);
+    // 2) Dodajemy sprzedających (giełda tworzy ich w swojej puli)
+    Sprzedajacy* s1 = g->utworzSprzedajacego("Sprzedawca_1");
+    Sprzedajacy* s2 = g->utworzSprzedajacego("Sprzedawca_2");
 
-    // 3) Sprzedający wystawiają oferty
-    Oferta* o1 = s1->wystawOferte("Krysztaly", 10.0, 5);
-    Oferta* o2 = s1->wystawOferte("Krysztaly", 12.5, 2);
-    Oferta* o3 = s2->wystawOferte("Krysztaly", 9.0, 10);
-
-    // Dodajemy je do giełdy
-    g->dodajOferte(o1);
-    g->dodajOferte(o2);
-    g->dodajOferte(o3);
+    // 3) Sprzedający wystawiają oferty (od razu trafiają na giełdę)
+    s1->wystawOferte("Krysztaly", 10.0, 5);
+    s1->wystawOferte("Krysztaly", 12.5, 2);
+    s2->wystawOferte("Krysztaly", 9.0, 10);
 
     // 4) Dodajemy kupujących o różnych strategiach
-    Kupujacy* kEko = new KupujacyEkonomiczny("Klient_Eko", 50.0);
-    Kupujacy* kWyb = new KupujacyWybredny("Klient_Wyb", 40.0);
-    Kupujacy* kDet = new KupujacyDetalista("Klient_Det", 25.0);
-
-    g->zarejestrujKupujacego(kEko);
-    g->zarejestrujKupujacego(kWyb);
-    g->zarejestrujKupujacego(kDet);
+    Kupujacy* kEko = g->utworzKupujacego<KupujacyEkonomiczny>("Klient_Eko", 50.0);
+    Kupujacy* kWyb = g->utworzKupujacego<KupujacyWybredny>("Klient_Wyb", 40.0);
+    Kupujacy* kDet = g->utworzKupujacego<KupujacyDetalista>("Klient_Det", 25.0);
 
     // 5) Kupujący kupują towar "Krysztaly"
     std::cout << "\n=== ZAKUPY ===\n";
-    g->kupTowar(kEko, "Krysztaly");
-    g->kupTowar(kWyb, "Krysztaly");
-    g->kupTowar(kDet, "Krysztaly");
+    // Wszyscy trzej w jednej turze - kolejność z tablicy decyduje o pierwszeństwie
+    std::vector<Kupujacy*> tura = { kEko, kWyb, kDet };
+    g->kupTowarGrupowo(tura, "Krysztaly");
 
     // 6) Wypisujemy stan giełdy po zakupach
     g->wypiszStan();
 
-    // 7) Usuwamy Giełdę (zwolni sprzedających, kupujących, oferty)
+    // 7) Migawka: zapisujemy stan do pliku tymczasowego i odtwarzamy go w nowej giełdzie
+    char migawka[] = "/tmp/gielda.migawka.XXXXXX";
+    int fd = ::mkstemp(migawka);
+    if (fd >= 0) {
+        ::close(fd);
+        if (g->zapiszStan(migawka)) {
+            Gielda* kopia = new Gielda();
+            if (kopia->wczytajStan(migawka)) {
+                std::cout << "\nOdtworzono z migawki (kupujący: " << kopia->liczbaKupujacych() << ")";
+                kopia->wypiszStan();
+            }
+            delete kopia;
+        }
+        std::remove(migawka);
+    }
+
+    // 8) Zlecenia ze strumienia CSV (tu z napisu, zwykle z pliku albo stdin)
+    static const char zlecenia[] =
+        "O,Sprzedawca_3,Krysztaly,8.5,3\n"
+        "B,Klient_Csv,E,20\n"
+        "K,Klient_Csv,Krysztaly\n";
+    std::FILE* wejscie = fmemopen(const_cast<char*>(zlecenia), sizeof(zlecenia) - 1, "r");
+    if (wejscie != nullptr) {
+        StrumienZlecen strumien(g, StrumienZlecen::Format::CSV);
+        strumien.wczytaj(wejscie);
+        std::fclose(wejscie);
+        g->wypiszStan();
+    }
+
+    // 9) Usuwamy Giełdę (zwolni sprzedających, kupujących, oferty)
     delete g;
 
     return 0;
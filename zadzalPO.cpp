@@ -2,9 +2,84 @@
 #include <string>
 #include <vector>
 #include <stdexcept>
+#include <string_view>
+#include <memory>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZADZAL_SIMD
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+//wartosciowanie z dostepem O(1): tablica 256 pozycji indeksowana nazwa zmiennej;
+//wartosci sa trzymane jako widoki - na wlasne kopie (ustaw) albo na cudze napisy (ustawWidok);
+//kopie powstaja tylko dla zmiennych ustawionych przez ustaw
+class Wartosciowanie{
+public:
+    static constexpr int ROZMIAR = 256;
+
+    Wartosciowanie() {}
+    Wartosciowanie(const Wartosciowanie &) = delete;
+    Wartosciowanie &operator=(const Wartosciowanie &) = delete;
+    //przy powtorzonej nazwie wygrywa pierwsza para (jak przy przeszukiwaniu wektora);
+    //bez kopiowania - wektor musi zyc, dopoki wartosciowanie jest uzywane
+    explicit Wartosciowanie(const vector<pair<char, string>> &pary){
+        for (auto &para : pary){
+            if (!czyZdefiniowana(pozycja(para.first))){
+                ustawWidok(para.first, para.second);
+            }
+        }
+    }
+    //tymczasowy wektor zniknalby przed pierwszym obliczeniem
+    Wartosciowanie(vector<pair<char, string>> &&) = delete;
+
+    static unsigned char pozycja(char nazwaZmiennej){
+        return static_cast<unsigned char>(nazwaZmiennej);
+    }
+
+    void ustaw(char nazwaZmiennej, const string &wartosc){
+        unique_ptr<string> &kopia = kopie[pozycja(nazwaZmiennej)];
+        if (kopia){
+            *kopia = wartosc;
+        }
+        else{
+            kopia.reset(new string(wartosc));
+        }
+        ustawWidok(nazwaZmiennej, *kopia);
+    }
+    //bez kopiowania - napis musi zyc, dopoki wartosciowanie jest uzywane
+    void ustawWidok(char nazwaZmiennej, string_view wartosc){
+        widoki[pozycja(nazwaZmiennej)] = wartosc;
+        zdefiniowana[pozycja(nazwaZmiennej)] = true;
+    }
+    void ustawWidok(char nazwaZmiennej, string &&wartosc) = delete; //tymczasowy napis - do tego jest ustaw
+    bool czyZdefiniowana(unsigned char poz) const{
+        return zdefiniowana[poz];
+    }
+    string_view wartosc(unsigned char poz) const{
+        if (!zdefiniowana[poz]){
+            throw runtime_error(
+                string("Zmienna :'") + static_cast<char>(poz) + "' niezdefiniowana w wartosciowaniu.");
+        }
+        return widoki[poz];
+    }
+
+private:
+    unique_ptr<string> kopie[ROZMIAR];
+    string_view widoki[ROZMIAR];
+    bool zdefiniowana[ROZMIAR] = {};
+};
+
+class Lina;
+class PlanZapisu;
+
 class Wyrazenie
 {
 public:
@@ -12,7 +87,25 @@ public:
 
     virtual string obliczBezWartosciowania() const = 0;
 
-    virtual string obliczZWartosciowaniem(const vector<pair<char, string>> &wartosciowanie) const = 0;
+    virtual string obliczZWartosciowaniem(const Wartosciowanie &wartosciowanie) const = 0;
+
+    //wygodna wersja dla wektora par - tablica widokow na cale obliczenie; przy wielu
+    //obliczeniach taniej zbudowac Wartosciowanie raz i podawac je wprost
+    //(klasy pochodne odslaniaja ja przez using, bo nadpisanie drugiej wersji by ja zaslonilo)
+    string obliczZWartosciowaniem(const vector<pair<char, string>> &wartosciowanie) const{
+        return obliczZWartosciowaniem(Wartosciowanie(wartosciowanie));
+    }
+
+    //obliczenie bez kopiowania: dopisuje do liny odcinki wskazujace na stale i wartosci zmiennych,
+    //wartosciowanie == nullptr oznacza obliczenie bez wartosciowania
+    virtual void zbierz(const Wartosciowanie *wartosciowanie, Lina &lina) const = 0;
+
+    //obliczenie dwufazowe: dokladna dlugosc wyniku, potem zapis pod cel (zwraca koniec zapisu)
+    virtual size_t zmierz(const Wartosciowanie *wartosciowanie, PlanZapisu &plan) const = 0;
+    virtual char *zapisz(const Wartosciowanie *wartosciowanie, PlanZapisu &plan, char *cel) const = 0;
+    //wynik, ktory juz lezy w pamieci (stala, wartosc zmiennej) - wtedy zamiast zapisz(); wezel
+    //bez krokow planu, wiec pominiecie zapisz() nie przesuwa odczytu planu
+    virtual bool widok(const Wartosciowanie *, string_view &) const { return false; }
 
     virtual void wypisz(ostream &os) const = 0;
 
@@ -25,17 +118,317 @@ ostream &operator<<(ostream &os, const Wyrazenie &w){
 }
 
 //funkcje pomocnicze
-string znajdzWartoscZmienna(char nazwaZmiennej,
-                            const vector<pair<char, string>> &wartosciowanie){
-    for (auto &para : wartosciowanie){
-        if (para.first == nazwaZmiennej){
-            return para.second;
+string znajdzWartoscZmienna(char nazwaZmiennej, const Wartosciowanie &wartosciowanie){
+    return string(wartosciowanie.wartosc(Wartosciowanie::pozycja(nazwaZmiennej)));
+}
+//jadra dzialajace na buforach: wersja zwykla (wzorcowa) i wektorowe SSE2/AVX2,
+//wybierane raz przy pierwszym uzyciu wedlug procesora
+
+//z[0..n) -> cel (moze byc tym samym buforem)
+void duzeSkalarnie(const char *z, size_t n, char *cel){
+    for (size_t i = 0; i < n; i++){
+        char c = z[i];
+        cel[i] = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+    }
+}
+void maleSkalarnie(const char *z, size_t n, char *cel){
+    for (size_t i = 0; i < n; i++){
+        char c = z[i];
+        cel[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+}
+//n1 + n2 bajtow do cel; dluzszy napis moze juz lezec w celu pod cel + dlugosc krotszego
+//(kazda wersja czyta bajty, zanim je nadpisze), krotszy nie moze nachodzic na cel
+char *przeplotSkalarnie(const char *s1, size_t n1, const char *s2, size_t n2, char *cel){
+    size_t wspolne = (n1 < n2 ? n1 : n2);
+    for (size_t i = 0; i < wspolne; i++){
+        *cel++ = s1[i];
+        *cel++ = s2[i];
+    }
+    //koncowka dluzszego - przy przeplocie w miejscu juz tu lezy
+    const char *reszta = (n1 > n2 ? s1 : s2) + wspolne;
+    size_t n = (n1 > n2 ? n1 : n2) - wspolne;
+    if (n && reszta != cel){
+        memmove(cel, reszta, n);
+    }
+    return cel + n;
+}
+//znaki s[i], dla ktorych maska[i % m] == '*' (co najwyzej n bajtow)
+char *maskujSkalarnie(const char *s, size_t n, const char *maska, size_t m, char *cel){
+    if (m == 0){
+        return cel;
+    }
+    for (size_t i = 0, j = 0; i < n; i++){
+        if (maska[j] == '*'){
+            *cel++ = s[i];
+        }
+        if (++j == m){
+            j = 0;
+        }
+    }
+    return cel;
+}
+
+#ifdef ZADZAL_SIMD
+//okna maski: krotka maska jest powielana na stosie, zeby zadne okno nie zawijalo
+class OknaMaski{
+public:
+    static constexpr size_t KROTKA = 64;
+
+    OknaMaski(const char *_maska, size_t _m, size_t szerokosc) : maska(_maska), m(_m){
+        if (m <= KROTKA){
+            for (size_t k = 0; k < m + szerokosc; k++){
+                powielona[k] = maska[k % m];
+            }
+            maska = powielona;
+        }
+    }
+    //szerokosc znakow maski od pozycji j < m
+    const char *okno(size_t j, size_t szerokosc){
+        if (m <= KROTKA || j + szerokosc <= m){
+            return maska + j;
+        }
+        for (size_t k = 0; k < szerokosc; k++){
+            zawiniete[k] = maska[j + k < m ? j + k : j + k - m];
+        }
+        return zawiniete;
+    }
+    size_t nastepne(size_t j, size_t szerokosc) const{
+        j += szerokosc;
+        return j >= m ? j % m : j;
+    }
+
+private:
+    const char *maska;
+    size_t m;
+    char powielona[KROTKA + 32];
+    char zawiniete[32];
+};
+
+__m128i zmienWielkosc(__m128i x, char od){
+    //bajty z [od, od + 26) -> po przesunieciu najmniejsze liczby ze znakiem
+    __m128i t = _mm_add_epi8(x, _mm_set1_epi8(static_cast<char>(128 - od)));
+    __m128i w = _mm_cmplt_epi8(t, _mm_set1_epi8(static_cast<char>(-128 + 26)));
+    return _mm_xor_si128(x, _mm_and_si128(w, _mm_set1_epi8(0x20)));
+}
+void duzeSSE2(const char *z, size_t n, char *cel){
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(z + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cel + i), zmienWielkosc(x, 'a'));
+    }
+    duzeSkalarnie(z + i, n - i, cel + i);
+}
+void maleSSE2(const char *z, size_t n, char *cel){
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(z + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cel + i), zmienWielkosc(x, 'A'));
+    }
+    maleSkalarnie(z + i, n - i, cel + i);
+}
+char *przeplotSSE2(const char *s1, size_t n1, const char *s2, size_t n2, char *cel){
+    size_t wspolne = (n1 < n2 ? n1 : n2);
+    size_t i = 0;
+    for (; i + 16 <= wspolne; i += 16){
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s1 + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s2 + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cel), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cel + 16), _mm_unpackhi_epi8(a, b));
+        cel += 32;
+    }
+    return przeplotSkalarnie(s1 + i, n1 - i, s2 + i, n2 - i, cel);
+}
+char *maskujSSE2(const char *s, size_t n, const char *maska, size_t m, char *cel){
+    if (m == 0){
+        return cel;
+    }
+    OknaMaski okna(maska, m, 16);
+    const __m128i gwiazdka = _mm_set1_epi8('*');
+    size_t i = 0, j = 0;
+    for (; i + 16 <= n; i += 16){
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(okna.okno(j, 16)));
+        unsigned bity = _mm_movemask_epi8(_mm_cmpeq_epi8(w, gwiazdka));
+        if (bity == 0xFFFF){
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(cel),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)));
+            cel += 16;
+        }
+        else{
+            for (; bity; bity &= bity - 1){
+                *cel++ = s[i + __builtin_ctz(bity)];
+            }
+        }
+        j = okna.nastepne(j, 16);
+    }
+    for (; i < n; i++){
+        if (maska[j] == '*'){
+            *cel++ = s[i];
+        }
+        if (++j == m){
+            j = 0;
+        }
+    }
+    return cel;
+}
+
+__attribute__((target("avx2"))) __m256i zmienWielkosc(__m256i x, char od){
+    __m256i t = _mm256_add_epi8(x, _mm256_set1_epi8(static_cast<char>(128 - od)));
+    __m256i w = _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(-128 + 26)), t);
+    return _mm256_xor_si256(x, _mm256_and_si256(w, _mm256_set1_epi8(0x20)));
+}
+__attribute__((target("avx2"))) void duzeAVX2(const char *z, size_t n, char *cel){
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32){
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(z + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(cel + i), zmienWielkosc(x, 'a'));
+    }
+    duzeSkalarnie(z + i, n - i, cel + i);
+}
+__attribute__((target("avx2"))) void maleAVX2(const char *z, size_t n, char *cel){
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32){
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(z + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(cel + i), zmienWielkosc(x, 'A'));
+    }
+    maleSkalarnie(z + i, n - i, cel + i);
+}
+__attribute__((target("avx2"))) char *przeplotAVX2(const char *s1, size_t n1, const char *s2, size_t n2, char *cel){
+    size_t wspolne = (n1 < n2 ? n1 : n2);
+    size_t i = 0;
+    for (; i + 32 <= wspolne; i += 32){
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s1 + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s2 + i));
+        //unpack dziala w polowkach po 128 bitow - permute2x128 sklada je w kolejnosci
+        __m256i lo = _mm256_unpacklo_epi8(a, b);
+        __m256i hi = _mm256_unpackhi_epi8(a, b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(cel), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(cel + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+        cel += 64;
+    }
+    return przeplotSkalarnie(s1 + i, n1 - i, s2 + i, n2 - i, cel);
+}
+//dla kazdego 8-bitowego kawalka maski: indeksy wybranych bajtow na poczatku (pshufb)
+const unsigned char (*tablicaKompresji())[8]{
+    static unsigned char tablica[256][8];
+    static bool gotowa = [](){
+        for (int b = 0; b < 256; b++){
+            int k = 0;
+            for (int bit = 0; bit < 8; bit++){
+                if (b >> bit & 1){
+                    tablica[b][k++] = static_cast<unsigned char>(bit);
+                }
+            }
+            while (k < 8){
+                tablica[b][k++] = 0x80;
+            }
+        }
+        return true;
+    }();
+    (void)gotowa;
+    return tablica;
+}
+__attribute__((target("avx2"))) char *maskujAVX2(const char *s, size_t n, const char *maska, size_t m, char *cel){
+    if (m == 0){
+        return cel;
+    }
+    //ile bajtow wyjdzie - zapis po 8 bajtow wolno robic tylko przed koncem wyniku
+    size_t gwiazdki = 0, reszta = 0;
+    for (size_t k = 0; k < m; k++){
+        gwiazdki += (maska[k] == '*');
+        reszta += (k < n % m && maska[k] == '*');
+    }
+    const char *koniec = cel + n / m * gwiazdki + reszta;
+    const unsigned char (*tablica)[8] = tablicaKompresji();
+    OknaMaski okna(maska, m, 32);
+    const __m256i gwiazdka = _mm256_set1_epi8('*');
+    size_t i = 0, j = 0;
+    for (; i + 32 <= n; i += 32){
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(okna.okno(j, 32)));
+        unsigned bity = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(w, gwiazdka)));
+        if (bity == 0xFFFFFFFFu){
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(cel),
+                                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)));
+            cel += 32;
+        }
+        else if (bity){
+            for (int g = 0; g < 4; g++){
+                unsigned b = (bity >> (8 * g)) & 0xFF;
+                __m128i dane = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(s + i + 8 * g));
+                __m128i wybor = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(tablica[b]));
+                __m128i upakowane = _mm_shuffle_epi8(dane, wybor);
+                size_t ile = __builtin_popcount(b);
+                if (cel + 8 <= koniec){
+                    _mm_storel_epi64(reinterpret_cast<__m128i *>(cel), upakowane);
+                }
+                else{
+                    char tmp[16];
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(tmp), upakowane);
+                    memcpy(cel, tmp, ile);
+                }
+                cel += ile;
+            }
+        }
+        j = okna.nastepne(j, 32);
+    }
+    for (; i < n; i++){
+        if (maska[j] == '*'){
+            *cel++ = s[i];
+        }
+        if (++j == m){
+            j = 0;
         }
     }
-    throw runtime_error(
-        string("Zmienna :'") + nazwaZmiennej + "' niezdefiniowana w wartosciowaniu.");
+    return cel;
+}
+#endif
+
+struct JadraTekstu{
+    const char *nazwa;
+    void (*duze)(const char *, size_t, char *);
+    void (*male)(const char *, size_t, char *);
+    char *(*przeplot)(const char *, size_t, const char *, size_t, char *);
+    char *(*maskuj)(const char *, size_t, const char *, size_t, char *);
+};
+
+//wszystkie wersje, ktore ten procesor potrafi wykonac - pierwsza jest wzorcowa
+vector<JadraTekstu> dostepneJadra(){
+    vector<JadraTekstu> jadra{{"skalarne", duzeSkalarnie, maleSkalarnie, przeplotSkalarnie, maskujSkalarnie}};
+#ifdef ZADZAL_SIMD
+    jadra.push_back({"SSE2", duzeSSE2, maleSSE2, przeplotSSE2, maskujSSE2});
+    if (__builtin_cpu_supports("avx2")){
+        jadra.push_back({"AVX2", duzeAVX2, maleAVX2, przeplotAVX2, maskujAVX2});
+    }
+#endif
+    return jadra;
+}
+
+const JadraTekstu &jadra(){
+    static const JadraTekstu wybrane = dostepneJadra().back();
+    return wybrane;
+}
+
+void przepiszDuze(const char *z, size_t n, char *cel){
+    jadra().duze(z, n, cel);
 }
+void przepiszMale(const char *z, size_t n, char *cel){
+    jadra().male(z, n, cel);
+}
+
 string naDuzeLitery(const string &s){
+    string wynik(s.size(), '\0');
+    przepiszDuze(s.data(), s.size(), &wynik[0]);
+    return wynik;
+}
+string naMaleLitery(const string &s){
+    string wynik(s.size(), '\0');
+    przepiszMale(s.data(), s.size(), &wynik[0]);
+    return wynik;
+}
+
+//pierwotne implementacje operacji na napisach - wolne, ale oczywiscie poprawne;
+//zostaja jako wzorzec, z ktorym sprawdzJadra porownuje wszystkie jadra
+string naDuzeLiteryWzorcowo(const string &s){
     string wynik;
     for (char c : s){
         if (c >= 'a' && c <= 'z'){
@@ -47,7 +440,7 @@ string naDuzeLitery(const string &s){
     }
     return wynik;
 }
-string naMaleLitery(const string &s){
+string naMaleLiteryWzorcowo(const string &s){
     string wynik;
     for (char c : s){
         if (c >= 'A' && c <= 'Z'){
@@ -59,8 +452,278 @@ string naMaleLitery(const string &s){
     }
     return wynik;
 }
+string maskujWzorcowo(const string &s1, const string &s2){
+    if (s2.empty()){
+        return "";
+    }
+    string powtorzony;
+    while (powtorzony.size() < s1.size()){
+        powtorzony += s2;
+    }
+    powtorzony.resize(s1.size());
+
+    string wynik;
+    for (size_t i = 0; i < s1.size(); i++){
+        if (powtorzony[i] == '*'){
+            wynik.push_back(s1[i]);
+        }
+    }
+    return wynik;
+}
+string przeplotWzorcowo(const string &s1, const string &s2){
+    string wynik;
+    size_t maxLen = (s1.size() > s2.size() ? s1.size() : s2.size());
+    for (size_t i = 0; i < maxLen; i++){
+        if (i < s1.size()){
+            wynik.push_back(s1[i]);
+        }
+        if (i < s2.size()){
+            wynik.push_back(s2[i]);
+        }
+    }
+    return wynik;
+}
+
+//porownanie kazdej wersji jader (takze skalarnej) z pierwotnymi implementacjami bajt po bajcie,
+//przeplot takze w miejscu (dluzszy napis juz w celu); false - ktores jadra licza inaczej
+bool sprawdzJadra(ostream &os){
+    string dane(700, '\0');
+    unsigned los = 12345;
+    for (char &c : dane){
+        los = los * 1103515245u + 12345u;
+        c = static_cast<char>(los >> 16); //wszystkie 256 wartosci, w tym litery na granicach zakresow
+    }
+    string maska = dane;
+    for (size_t k = 0; k < maska.size(); k++){
+        maska[k] = (dane[k] & 1) ? '*' : 'a';
+    }
+    bool ok = true;
+    for (const JadraTekstu &j : dostepneJadra()){
+        bool zgodne = true;
+        string b(1300, '\0');
+        auto rowne = [&](const string &wzor, const char *koniec){
+            return static_cast<size_t>(koniec - &b[0]) == wzor.size() && b.compare(0, wzor.size(), wzor) == 0;
+        };
+        for (size_t n = 0; n <= 300 && zgodne; n++){
+            string s(dane, 0, n);
+            j.duze(s.data(), n, &b[0]);
+            zgodne = zgodne && rowne(naDuzeLiteryWzorcowo(s), &b[0] + n);
+            j.male(s.data(), n, &b[0]);
+            zgodne = zgodne && rowne(naMaleLiteryWzorcowo(s), &b[0] + n);
+            for (size_t n2 : {size_t(0), n / 3, n, n + 17, size_t(299)}){
+                string s2(dane, 300, n2);
+                string wzor = przeplotWzorcowo(s, s2);
+                zgodne = zgodne && rowne(wzor, j.przeplot(s.data(), n, s2.data(), n2, &b[0]));
+                //w miejscu: dluzszy pod &b[0] + dlugosc krotszego
+                const char *p1 = s.data(), *p2 = s2.data();
+                if (n >= n2){
+                    s.copy(&b[n2], n);
+                    p1 = &b[n2];
+                }
+                else{
+                    s2.copy(&b[n], n2);
+                    p2 = &b[n];
+                }
+                zgodne = zgodne && rowne(wzor, j.przeplot(p1, n, p2, n2, &b[0]));
+            }
+            for (size_t m : {size_t(0), size_t(1), size_t(2), size_t(5), size_t(16), size_t(33), size_t(64),
+                             size_t(65), size_t(100), size_t(297)}){
+                for (size_t przes : {size_t(0), size_t(7), size_t(200)}){
+                    char *kb = j.maskuj(s.data(), n, maska.data() + przes, m, &b[0]);
+                    zgodne = zgodne && rowne(maskujWzorcowo(s, maska.substr(przes, m)), kb);
+                }
+            }
+        }
+        os << "jadra " << j.nazwa << ": " << (zgodne ? "zgodne" : "NIEZGODNE") << " z wersja wzorcowa\n";
+        ok = ok && zgodne;
+    }
+    return ok;
+}
+
+//pamiec na napisy posrednie: bloki po 64 KiB, ktore sie nie przesuwaja (wskazniki zostaja wazne)
+//i przezywaja wyczysc(), wiec wielokrotnie uzywana nie alokuje juz nic
+class PamiecBlokowa{
+public:
+    PamiecBlokowa() {}
+    PamiecBlokowa(const PamiecBlokowa &) = delete;
+    PamiecBlokowa &operator=(const PamiecBlokowa &) = delete;
+
+    void wyczysc(){
+        biezacy = 0;
+        zajete = 0;
+    }
+
+    //miejsce na n bajtow, wazne do wyczysc()
+    char *przydziel(size_t n){
+        while (biezacy < bloki.size()){
+            if (zajete + n <= bloki[biezacy].rozmiar){
+                char *p = bloki[biezacy].dane.get() + zajete;
+                zajete += n;
+                return p;
+            }
+            biezacy++;
+            zajete = 0;
+        }
+        size_t rozmiar = n > BLOK ? n : BLOK;
+        bloki.push_back({unique_ptr<char[]>(new char[rozmiar]), rozmiar});
+        zajete = n;
+        return bloki.back().dane.get();
+    }
+
+private:
+    static constexpr size_t BLOK = 1 << 16;
+    struct Blok{
+        unique_ptr<char[]> dane;
+        size_t rozmiar;
+    };
+
+    vector<Blok> bloki;
+    size_t biezacy = 0;
+    size_t zajete = 0;
+};
+
+//wynik obliczenia jako lista odcinkow (string_view) z ewentualna zmiana wielkosci liter;
+//napisy posrednie (@, *, #) trafiaja do PamieciBlokowej
+class Lina{
+public:
+    enum Wielkosc : unsigned char { BEZ_ZMIAN, DUZE, MALE };
+    struct Odcinek{
+        string_view tekst;
+        Wielkosc wielkosc;
+    };
+
+    Lina() {}
+    Lina(const Lina &) = delete;
+    Lina &operator=(const Lina &) = delete;
+
+    void wyczysc(){
+        odcinki.clear();
+        pamiec.wyczysc();
+    }
+
+    size_t liczbaOdcinkow() const { return odcinki.size(); }
+    void dodaj(string_view tekst, Wielkosc wielkosc = BEZ_ZMIAN){
+        if (!tekst.empty()){
+            odcinki.push_back({tekst, wielkosc});
+        }
+    }
+    void obetnij(size_t od) { odcinki.resize(od); }
+    //zewnetrzna zmiana wielkosci liter przykrywa wewnetrzna
+    void ustawWielkosc(size_t od, Wielkosc wielkosc){
+        for (size_t i = od; i < odcinki.size(); i++){
+            odcinki[i].wielkosc = wielkosc;
+        }
+    }
+
+    size_t dlugosc(size_t od = 0) const{
+        size_t n = 0;
+        for (size_t i = od; i < odcinki.size(); i++){
+            n += odcinki[i].tekst.size();
+        }
+        return n;
+    }
+
+    char *przydziel(size_t n) { return pamiec.przydziel(n); }
+
+    //odcinki [od, do_) jako jeden ciagly napis - bez kopii, jesli to jeden niezmieniony odcinek
+    string_view splaszcz(size_t od, size_t do_){
+        if (do_ == od){
+            return string_view();
+        }
+        if (do_ == od + 1 && odcinki[od].wielkosc == BEZ_ZMIAN){
+            return odcinki[od].tekst;
+        }
+        size_t n = 0;
+        for (size_t i = od; i < do_; i++){
+            n += odcinki[i].tekst.size();
+        }
+        char *cel = przydziel(n);
+        char *p = cel;
+        for (size_t i = od; i < do_; i++){
+            p = przepisz(odcinki[i], p);
+        }
+        return string_view(cel, n);
+    }
 
+    //jedyne kopiowanie calego wyniku - do bufora podanego przez wywolujacego
+    void zapisz(string &wynik) const{
+        wynik.resize(dlugosc());
+        char *p = &wynik[0];
+        for (auto &o : odcinki){
+            p = przepisz(o, p);
+        }
+    }
+
+private:
+    static char *przepisz(const Odcinek &o, char *cel){
+        switch (o.wielkosc){
+        case DUZE:
+            przepiszDuze(o.tekst.data(), o.tekst.size(), cel);
+            break;
+        case MALE:
+            przepiszMale(o.tekst.data(), o.tekst.size(), cel);
+            break;
+        default:
+            o.tekst.copy(cel, o.tekst.size());
+        }
+        return cel + o.tekst.size();
+    }
+
+    vector<Odcinek> odcinki;
+    PamiecBlokowa pamiec;
+};
+
+//plan obliczenia dwufazowego: faza zmierz() liczy dokladne dlugosci od lisci w gore i zapisuje
+//kroki potrzebne wezlom @, * i #; faza zapisz() czyta je w tej samej kolejnosci i pisze
+//wynik kazdego wezla prosto na jego miejsce w jednym buforze
+class PlanZapisu{
+public:
+    struct Krok{
+        size_t lewy = 0;   //dlugosc lewego (lub jedynego) argumentu
+        size_t prawy = 0;  //dlugosc prawego argumentu
+        size_t dalej = 0;  //gdzie czytac po tym wezle, jesli poddrzewo nie jest zapisywane
+        string_view maska; //policzona juz maska dla *
+    };
+
+    PlanZapisu() {}
+    PlanZapisu(const PlanZapisu &) = delete;
+    PlanZapisu &operator=(const PlanZapisu &) = delete;
+
+    void wyczysc(){
+        kroki.clear();
+        nastepny = 0;
+        pamiec.wyczysc();
+    }
+
+    //faza pierwsza
+    size_t dodajKrok(){
+        kroki.emplace_back();
+        return kroki.size() - 1;
+    }
+    Krok &krok(size_t nr) { return kroki[nr]; }
+    size_t liczbaKrokow() const { return kroki.size(); }
+
+    //faza druga
+    const Krok &pobierzKrok() { return kroki[nastepny++]; }
+    void przejdzDo(size_t nr) { nastepny = nr; }
+    size_t pozycja() const { return nastepny; }
+
+    char *przydziel(size_t n) { return pamiec.przydziel(n); }
+
+private:
+    vector<Krok> kroki;
+    size_t nastepny = 0;
+    PamiecBlokowa pamiec;
+};
 
+size_t liczbaCyfr(size_t n){
+    size_t c = 1;
+    while (n >= 10){
+        n /= 10;
+        c++;
+    }
+    return c;
+}
 
 
 
@@ -74,10 +737,25 @@ public:
     string obliczBezWartosciowania() const override{
         return wartosc;
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &) const override{
         return wartosc;
     }
 
+    void zbierz(const Wartosciowanie *, Lina &lina) const override{
+        lina.dodaj(wartosc);
+    }
+    size_t zmierz(const Wartosciowanie *, PlanZapisu &) const override{
+        return wartosc.size();
+    }
+    char *zapisz(const Wartosciowanie *, PlanZapisu &, char *cel) const override{
+        return cel + wartosc.copy(cel, wartosc.size());
+    }
+    bool widok(const Wartosciowanie *, string_view &wynik) const override{
+        wynik = wartosc;
+        return true;
+    }
+
     void wypisz(ostream &os) const override{
         os << "\"" << wartosc << "\"";
     }
@@ -89,20 +767,46 @@ private:
 class ZmiennaWyrazenie : public Wyrazenie
 {
 public:
-    ZmiennaWyrazenie(char c) : nazwaZmiennej(c) {}
+    ZmiennaWyrazenie(char c) : nazwaZmiennej(c), pozycja(Wartosciowanie::pozycja(c)) {}
 
     ZmiennaWyrazenie(const ZmiennaWyrazenie &) = delete;
     ZmiennaWyrazenie &operator=(const ZmiennaWyrazenie &) = delete;
 
     string obliczBezWartosciowania() const override{
         //cout << " brak wyniku ";
-        throw runtime_error(
-            string("Zmienna '") + nazwaZmiennej + "' nie ma wartosci bez wartosciowania."
-        );
+        brakWartosciowania();
+    }
+
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &wartosciowanie) const override{
+        return string(wartosciowanie.wartosc(pozycja));
     }
 
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &wartosciowanie) const override{
-        return znajdzWartoscZmienna(nazwaZmiennej, wartosciowanie);
+    void zbierz(const Wartosciowanie *wartosciowanie, Lina &lina) const override{
+        if (!wartosciowanie){
+            brakWartosciowania();
+        }
+        lina.dodaj(wartosciowanie->wartosc(pozycja));
+    }
+    size_t zmierz(const Wartosciowanie *wartosciowanie, PlanZapisu &) const override{
+        if (!wartosciowanie){
+            brakWartosciowania();
+        }
+        return wartosciowanie->wartosc(pozycja).size();
+    }
+    char *zapisz(const Wartosciowanie *wartosciowanie, PlanZapisu &, char *cel) const override{
+        if (!wartosciowanie){
+            brakWartosciowania();
+        }
+        string_view wartosc = wartosciowanie->wartosc(pozycja);
+        return cel + wartosc.copy(cel, wartosc.size());
+    }
+    bool widok(const Wartosciowanie *wartosciowanie, string_view &wynik) const override{
+        if (!wartosciowanie){
+            brakWartosciowania();
+        }
+        wynik = wartosciowanie->wartosc(pozycja);
+        return true;
     }
 
     void wypisz(ostream &os) const override{
@@ -110,7 +814,14 @@ public:
     }
 
 private:
+    [[noreturn]] void brakWartosciowania() const{
+        throw runtime_error(
+            string("Zmienna '") + nazwaZmiennej + "' nie ma wartosci bez wartosciowania."
+        );
+    }
+
     char nazwaZmiennej;
+    unsigned char pozycja; //wyliczona raz przy budowie
 };
 
 class DoDuzychLiterWyrazenie : public Wyrazenie
@@ -125,10 +836,25 @@ public:
     string obliczBezWartosciowania() const override{
         return naDuzeLitery(podrzedne->obliczBezWartosciowania());
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &w) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &w) const override{
         return naDuzeLitery(podrzedne->obliczZWartosciowaniem(w));
     }
 
+    void zbierz(const Wartosciowanie *w, Lina &lina) const override{
+        size_t od = lina.liczbaOdcinkow();
+        podrzedne->zbierz(w, lina);
+        lina.ustawWielkosc(od, Lina::DUZE);
+    }
+    size_t zmierz(const Wartosciowanie *w, PlanZapisu &plan) const override{
+        return podrzedne->zmierz(w, plan);
+    }
+    char *zapisz(const Wartosciowanie *w, PlanZapisu &plan, char *cel) const override{
+        char *koniec = podrzedne->zapisz(w, plan, cel);
+        przepiszDuze(cel, koniec - cel, cel);
+        return koniec;
+    }
+
     void wypisz(ostream &os) const override{
         os << "^(" << *podrzedne << ")";
     }
@@ -148,10 +874,25 @@ public:
     string obliczBezWartosciowania() const override{
         return naMaleLitery(podrzedne->obliczBezWartosciowania());
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &w) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &w) const override{
         return naMaleLitery(podrzedne->obliczZWartosciowaniem(w));
     }
 
+    void zbierz(const Wartosciowanie *w, Lina &lina) const override{
+        size_t od = lina.liczbaOdcinkow();
+        podrzedne->zbierz(w, lina);
+        lina.ustawWielkosc(od, Lina::MALE);
+    }
+    size_t zmierz(const Wartosciowanie *w, PlanZapisu &plan) const override{
+        return podrzedne->zmierz(w, plan);
+    }
+    char *zapisz(const Wartosciowanie *w, PlanZapisu &plan, char *cel) const override{
+        char *koniec = podrzedne->zapisz(w, plan, cel);
+        przepiszMale(cel, koniec - cel, cel);
+        return koniec;
+    }
+
     void wypisz(ostream &os) const override{
         os << "_(" << *podrzedne << ")";
     }
@@ -172,11 +913,35 @@ public:
         string val = podrzedne->obliczBezWartosciowania();
         return to_string(val.size());
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &w) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &w) const override{
         string val = podrzedne->obliczZWartosciowaniem(w);
         return to_string(val.size());
     }
 
+    void zbierz(const Wartosciowanie *w, Lina &lina) const override{
+        size_t od = lina.liczbaOdcinkow();
+        podrzedne->zbierz(w, lina);
+        size_t n = lina.dlugosc(od);
+        lina.obetnij(od);
+        char *cyfry = lina.przydziel(20);
+        char *koniec = to_chars(cyfry, cyfry + 20, n).ptr;
+        lina.dodaj(string_view(cyfry, koniec - cyfry));
+    }
+    //wystarczy dlugosc argumentu - samego argumentu nigdy sie nie zapisuje
+    size_t zmierz(const Wartosciowanie *w, PlanZapisu &plan) const override{
+        size_t nr = plan.dodajKrok();
+        size_t n = podrzedne->zmierz(w, plan);
+        plan.krok(nr).lewy = n;
+        plan.krok(nr).dalej = plan.liczbaKrokow();
+        return liczbaCyfr(n);
+    }
+    char *zapisz(const Wartosciowanie *, PlanZapisu &plan, char *cel) const override{
+        const PlanZapisu::Krok &k = plan.pobierzKrok();
+        plan.przejdzDo(k.dalej);
+        return to_chars(cel, cel + 20, k.lewy).ptr;
+    }
+
     void wypisz(ostream &os) const override{
         os << "#(" << *podrzedne << ")";
     }
@@ -212,10 +977,22 @@ public:
     string obliczBezWartosciowania() const override{
         return lewe->obliczBezWartosciowania() + prawe->obliczBezWartosciowania();
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &w) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &w) const override{
         return lewe->obliczZWartosciowaniem(w) + prawe->obliczZWartosciowaniem(w);
     }
 
+    void zbierz(const Wartosciowanie *w, Lina &lina) const override{
+        lewe->zbierz(w, lina);
+        prawe->zbierz(w, lina);
+    }
+    size_t zmierz(const Wartosciowanie *w, PlanZapisu &plan) const override{
+        return lewe->zmierz(w, plan) + prawe->zmierz(w, plan);
+    }
+    char *zapisz(const Wartosciowanie *w, PlanZapisu &plan, char *cel) const override{
+        return prawe->zapisz(w, plan, lewe->zapisz(w, plan, cel));
+    }
+
     void wypisz(ostream &os) const override{
         os << "(" << *lewe << " & " << *prawe << ")";
     }
@@ -232,28 +1009,81 @@ public:
     string obliczBezWartosciowania() const override{
         return maskuj(lewe->obliczBezWartosciowania(), prawe->obliczBezWartosciowania());
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &w) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &w) const override{
         return maskuj(lewe->obliczZWartosciowaniem(w), prawe->obliczZWartosciowaniem(w));
     }
 
     static string maskuj(const string &s1, const string &s2){
-        if (s2.empty()){
-            return "";
+        string wynik(s1.size(), '\0');
+        char *koniec = jadra().maskuj(s1.data(), s1.size(), s2.data(), s2.size(), &wynik[0]);
+        wynik.resize(koniec - &wynik[0]);
+        return wynik;
+    }
+
+    void zbierz(const Wartosciowanie *w, Lina &lina) const override{
+        size_t od = lina.liczbaOdcinkow();
+        lewe->zbierz(w, lina);
+        size_t srodek = lina.liczbaOdcinkow();
+        prawe->zbierz(w, lina);
+        string_view s1 = lina.splaszcz(od, srodek);
+        string_view s2 = lina.splaszcz(srodek, lina.liczbaOdcinkow());
+        lina.obetnij(od);
+        char *cel = lina.przydziel(s1.size());
+        char *koniec = jadra().maskuj(s1.data(), s1.size(), s2.data(), s2.size(), cel);
+        lina.dodaj(string_view(cel, koniec - cel));
+    }
+    //dlugosc zalezy od tresci maski, wiec maska jest liczona juz w pierwszej fazie i zapamietana;
+    //kazda maska powstaje raz (maska-lisc wcale - to widok), a zapisz() i przodkowie czytaja
+    //zapamietany widok i przeskakuja kroki prawego argumentu
+    size_t zmierz(const Wartosciowanie *w, PlanZapisu &plan) const override{
+        size_t nr = plan.dodajKrok();
+        size_t n1 = lewe->zmierz(w, plan);
+        size_t poczatekPrawego = plan.liczbaKrokow();
+        size_t n2 = prawe->zmierz(w, plan);
+        size_t dalej = plan.liczbaKrokow();
+        string_view maska;
+        if (!prawe->widok(w, maska)){
+            char *bufor = plan.przydziel(n2);
+            plan.przejdzDo(poczatekPrawego);
+            prawe->zapisz(w, plan, bufor);
+            maska = string_view(bufor, n2);
         }
-        string powtorzony;
-        while (powtorzony.size() < s1.size()){
-            powtorzony += s2;
+        PlanZapisu::Krok &k = plan.krok(nr);
+        k.lewy = n1;
+        k.prawy = n2;
+        k.dalej = dalej;
+        k.maska = maska;
+        if (n2 == 0){
+            return 0;
         }
-        powtorzony.resize(s1.size());
-
-        string wynik;
-        for (size_t i = 0; i < s1.size(); i++){
-            if (powtorzony[i] == '*'){
-                wynik.push_back(s1[i]);
-            }
+        size_t gwiazdki = 0;
+        for (char c : maska){
+            gwiazdki += (c == '*');
+        }
+        size_t wynik = n1 / n2 * gwiazdki;
+        for (size_t j = 0; j < n1 % n2; j++){
+            wynik += (maska[j] == '*');
         }
         return wynik;
     }
+    //lewy argument do pamieci pomocniczej (wynik jest krotszy, wiec nie zmiescilby sie w celu),
+    //chyba ze jest lisciem - wtedy maskujemy prosto z jego napisu
+    char *zapisz(const Wartosciowanie *w, PlanZapisu &plan, char *cel) const override{
+        const PlanZapisu::Krok k = plan.pobierzKrok();
+        if (k.prawy == 0){
+            plan.przejdzDo(k.dalej);
+            return cel;
+        }
+        string_view s1;
+        if (!lewe->widok(w, s1)){
+            char *bufor = plan.przydziel(k.lewy);
+            lewe->zapisz(w, plan, bufor);
+            s1 = string_view(bufor, k.lewy);
+        }
+        plan.przejdzDo(k.dalej);
+        return jadra().maskuj(s1.data(), k.lewy, k.maska.data(), k.prawy, cel);
+    }
 
     void wypisz(ostream &os) const override{
         os << "(" << *lewe << " * " << *prawe << ")";
@@ -269,36 +1099,76 @@ public:
     PrzeplotWyrazenie &operator=(const PrzeplotWyrazenie &) = delete;
 
     static string przeplot(const string &s1, const string &s2){
-        string wynik;
-        size_t maxLen = (s1.size() > s2.size() ? s1.size() : s2.size());
-        for (size_t i = 0; i < maxLen; i++){
-            if (i < s1.size()){
-                wynik.push_back(s1[i]);
-            }
-            if (i < s2.size()){
-                wynik.push_back(s2[i]);
-            }    
-        }
+        string wynik(s1.size() + s2.size(), '\0');
+        jadra().przeplot(s1.data(), s1.size(), s2.data(), s2.size(), &wynik[0]);
         return wynik;
     }
 
     string obliczBezWartosciowania() const override{
         return przeplot(lewe->obliczBezWartosciowania(), prawe->obliczBezWartosciowania());
     }
-    string obliczZWartosciowaniem(const vector<pair<char, string>> &w) const override{
+    using Wyrazenie::obliczZWartosciowaniem;
+    string obliczZWartosciowaniem(const Wartosciowanie &w) const override{
         return przeplot(lewe->obliczZWartosciowaniem(w), prawe->obliczZWartosciowaniem(w));
     }
 
+    void zbierz(const Wartosciowanie *w, Lina &lina) const override{
+        size_t od = lina.liczbaOdcinkow();
+        lewe->zbierz(w, lina);
+        size_t srodek = lina.liczbaOdcinkow();
+        prawe->zbierz(w, lina);
+        string_view s1 = lina.splaszcz(od, srodek);
+        string_view s2 = lina.splaszcz(srodek, lina.liczbaOdcinkow());
+        lina.obetnij(od);
+        char *cel = lina.przydziel(s1.size() + s2.size());
+        jadra().przeplot(s1.data(), s1.size(), s2.data(), s2.size(), cel);
+        lina.dodaj(string_view(cel, s1.size() + s2.size()));
+    }
+    size_t zmierz(const Wartosciowanie *w, PlanZapisu &plan) const override{
+        size_t nr = plan.dodajKrok();
+        size_t n1 = lewe->zmierz(w, plan);
+        size_t n2 = prawe->zmierz(w, plan);
+        plan.krok(nr).lewy = n1;
+        plan.krok(nr).prawy = n2;
+        return n1 + n2;
+    }
+    //dluzszy argument od razu w celu, pod cel + dlugosc krotszego (jego koncowka jest juz na
+    //swoim miejscu, a przeplot czyta go przed nadpisaniem), krotszy do pamieci pomocniczej;
+    //liscie nie sa zapisywane wcale - przeplot czyta ich napisy
+    char *zapisz(const Wartosciowanie *w, PlanZapisu &plan, char *cel) const override{
+        const PlanZapisu::Krok k = plan.pobierzKrok();
+        bool lewyDluzszy = k.lewy >= k.prawy;
+        const char *s1 = argument(lewe, w, plan, k.lewy, lewyDluzszy ? cel + k.prawy : nullptr);
+        const char *s2 = argument(prawe, w, plan, k.prawy, lewyDluzszy ? nullptr : cel + k.lewy);
+        return jadra().przeplot(s1, k.lewy, s2, k.prawy, cel);
+    }
+
     void wypisz(ostream &os) const override{
         os << "(" << *lewe << " @ " << *prawe << ")";
     }
+
+private:
+    //napis argumentu o dlugosci n: widok liscia albo zapis pod miejsce (nullptr - pamiec pomocnicza)
+    static const char *argument(const Wyrazenie *a, const Wartosciowanie *w, PlanZapisu &plan, size_t n,
+                                char *miejsce){
+        string_view v;
+        if (a->widok(w, v)){
+            return v.data();
+        }
+        if (!miejsce){
+            miejsce = plan.przydziel(n);
+        }
+        a->zapisz(w, plan, miejsce);
+        return miejsce;
+    }
 };
 
 //funkcja pomocnicza do liczenia z wartościowaniem i bez oraz do łapania bledow
-string oblicz(const Wyrazenie* w, bool zWartosciowaniem, const vector<pair<char, string>>& wartosciowanie = {}){
+//(wartosciowanie == nullptr - bez wartosciowania)
+string oblicz(const Wyrazenie* w, const Wartosciowanie* wartosciowanie){
     try {
-        if (zWartosciowaniem) {
-            return w->obliczZWartosciowaniem(wartosciowanie);
+        if (wartosciowanie) {
+            return w->obliczZWartosciowaniem(*wartosciowanie);
         } else {
             return w->obliczBezWartosciowania();
         }
@@ -309,15 +1179,298 @@ string oblicz(const Wyrazenie* w, bool zWartosciowaniem, const vector<pair<char,
 }
 
 
+//obliczenie bez kopii posrednich: lina i wynik sa podawane przez wywolujacego i moga byc
+//uzywane wielokrotnie (wartosciowanie == nullptr - bez wartosciowania)
+void obliczBezKopii(const Wyrazenie &w, const Wartosciowanie *wartosciowanie, Lina &lina, string &wynik){
+    lina.wyczysc();
+    w.zbierz(wartosciowanie, lina);
+    lina.zapisz(wynik);
+}
+
+//obliczenie dwufazowe: jeden bufor o dokladnie policzonej dlugosci, bez dopisywania po kawalku
+void obliczDwufazowo(const Wyrazenie &w, const Wartosciowanie *wartosciowanie, PlanZapisu &plan, string &wynik){
+    plan.wyczysc();
+    wynik.resize(w.zmierz(wartosciowanie, plan));
+    plan.przejdzDo(0);
+    w.zapisz(wartosciowanie, plan, &wynik[0]);
+}
+
+//wartosciowania wielu rekordow kolumnami: jedna kolumna na zmienna, wartosci kolumny
+//sklejone w jednym napisie z tablica poczatkow
+class TabelaWartosciowan{
+public:
+    size_t dodajKolumne(char nazwaZmiennej){
+        kolumny.push_back({nazwaZmiennej, string(), vector<size_t>(1, 0)});
+        return kolumny.size() - 1;
+    }
+    void dopisz(size_t kolumna, string_view wartosc){
+        Kolumna &k = kolumny[kolumna];
+        k.dane.append(wartosc.data(), wartosc.size());
+        k.poczatki.push_back(k.dane.size());
+    }
+
+    size_t liczbaKolumn() const { return kolumny.size(); }
+    //wszystkie kolumny musza miec tyle samo wartosci
+    size_t liczbaRekordow() const{
+        size_t n = kolumny.empty() ? 0 : kolumny[0].poczatki.size() - 1;
+        for (auto &k : kolumny){
+            if (k.poczatki.size() - 1 != n){
+                throw runtime_error(string("Kolumna '") + k.nazwa + "' ma inna liczbe wartosci.");
+            }
+        }
+        return n;
+    }
+    char nazwa(size_t kolumna) const { return kolumny[kolumna].nazwa; }
+    string_view wartosc(size_t kolumna, size_t rekord) const{
+        const Kolumna &k = kolumny[kolumna];
+        return string_view(k.dane).substr(k.poczatki[rekord], k.poczatki[rekord + 1] - k.poczatki[rekord]);
+    }
+
+private:
+    struct Kolumna{
+        char nazwa;
+        string dane;
+        vector<size_t> poczatki;
+    };
+    vector<Kolumna> kolumny;
+};
+
+//wyniki wszystkich rekordow jeden za drugim w jednym napisie; rekord bez wyniku
+//(np. brak zmiennej w tabeli) ma pusty wynik i blad != 0 - chyba ze blad (brak pamieci)
+//wystapil dopiero przy zapisie, wtedy miejsce rekordu ma nieokreslona tresc
+struct WynikiPakietu{
+    string dane;
+    vector<size_t> poczatki;
+    vector<unsigned char> bledy;
+
+    string_view wynik(size_t rekord) const{
+        return string_view(dane).substr(poczatki[rekord], poczatki[rekord + 1] - poczatki[rekord]);
+    }
+};
+
+//watki robocze tworzone raz i usypiane miedzy zleceniami; wywolujacy pracuje jako watek 0.
+//Zlecenia z roznych watkow ida po kolei; funkcja zlecenia nie moze zlecac pracy tej samej puli.
+//Pierwszy wyjatek z funkcji jest rzucany u wywolujacego, gdy wszystkie watki skoncza.
+class PulaWatkow{
+public:
+    explicit PulaWatkow(unsigned pomocnicze) : zakresy(new Zakres[pomocnicze + 1]){
+        for (unsigned t = 1; t <= pomocnicze; t++){
+            robotnicy.emplace_back([this, t](){ petla(t); });
+        }
+    }
+    ~PulaWatkow(){
+        {
+            lock_guard<mutex> l(blokada);
+            koniec = true;
+        }
+        budzik.notify_all();
+        for (auto &r : robotnicy){
+            r.join();
+        }
+    }
+
+    PulaWatkow(const PulaWatkow &) = delete;
+    PulaWatkow &operator=(const PulaWatkow &) = delete;
+
+    //tyle watkow, ile rdzeni
+    static PulaWatkow &wspolna(){
+        static PulaWatkow pula(thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 0);
+        return pula;
+    }
+
+    unsigned liczbaWatkow() const { return static_cast<unsigned>(robotnicy.size()) + 1; }
+
+    //funkcja(t, nr) dla zadan 0..liczbaZadan-1 na watkach t < watki (0 - wszystkie): zadania
+    //rozdzielone po rowno, a watek, ktory skonczy swoje, podkrada z zakresow pozostalych
+    //(ten sam licznik, wiec zadanie bierze dokladnie jeden watek)
+    template <typename Funkcja>
+    void wykonaj(size_t liczbaZadan, unsigned watki, Funkcja &&funkcja){
+        lock_guard<mutex> jedno(zlecenia);
+        watki = ograniczone(watki);
+        for (unsigned t = 0; t < watki; t++){
+            zakresy[t].nastepny = liczbaZadan * t / watki;
+            zakresy[t].koniec = liczbaZadan * (t + 1) / watki;
+        }
+        auto praca = [&](unsigned t){
+            for (unsigned k = 0; k < watki; k++){
+                Zakres &z = zakresy[(t + k) % watki];
+                for (size_t nr = z.nastepny.fetch_add(1); nr < z.koniec; nr = z.nastepny.fetch_add(1)){
+                    funkcja(t, nr);
+                }
+            }
+        };
+        uruchom(watki, praca);
+    }
+    //funkcja(t) raz na kazdym z watkow t < watki (0 - wszystkie)
+    template <typename Funkcja>
+    void wykonajNaKazdym(unsigned watki, Funkcja &&funkcja){
+        lock_guard<mutex> jedno(zlecenia);
+        uruchom(ograniczone(watki), funkcja);
+    }
+
+private:
+    struct Zakres{
+        alignas(64) atomic<size_t> nastepny;
+        size_t koniec;
+    };
+
+    unsigned ograniczone(unsigned watki) const{
+        return (watki == 0 || watki > liczbaWatkow()) ? liczbaWatkow() : watki;
+    }
+
+    template <typename Praca>
+    void uruchom(unsigned watki, Praca &praca){
+        {
+            lock_guard<mutex> l(blokada);
+            zlecenie = [](void *p, unsigned t){ (*static_cast<Praca *>(p))(t); };
+            daneZlecenia = &praca;
+            aktywne = watki;
+            pozostalo = watki - 1;
+            pokolenie++;
+        }
+        budzik.notify_all();
+        wykonajBezpiecznie(0);
+        unique_lock<mutex> l(blokada);
+        gotowe.wait(l, [&](){ return pozostalo == 0; });
+        if (blad){
+            exception_ptr b = blad;
+            blad = nullptr;
+            rethrow_exception(b);
+        }
+    }
+
+    void wykonajBezpiecznie(unsigned t){
+        try {
+            zlecenie(daneZlecenia, t);
+        }
+        catch (...) {
+            lock_guard<mutex> l(blokada);
+            if (!blad){
+                blad = current_exception();
+            }
+        }
+    }
+
+    void petla(unsigned t){
+        size_t widziane = 0;
+        for (;;){
+            {
+                unique_lock<mutex> l(blokada);
+                budzik.wait(l, [&](){ return koniec || pokolenie != widziane; });
+                if (koniec){
+                    return;
+                }
+                widziane = pokolenie;
+                if (t >= aktywne){
+                    continue;
+                }
+            }
+            wykonajBezpiecznie(t);
+            lock_guard<mutex> l(blokada);
+            if (--pozostalo == 0){
+                gotowe.notify_one();
+            }
+        }
+    }
+
+    vector<thread> robotnicy;
+    unique_ptr<Zakres[]> zakresy;
+    mutex zlecenia; //jedno zlecenie naraz
+    mutex blokada;  //ponizsze pola
+    condition_variable budzik, gotowe;
+    void (*zlecenie)(void *, unsigned) = nullptr;
+    void *daneZlecenia = nullptr;
+    unsigned aktywne = 0;
+    unsigned pozostalo = 0;
+    size_t pokolenie = 0;
+    exception_ptr blad;
+    bool koniec = false;
+};
+
+//jedno wyrazenie dla kazdego rekordu tabeli: najpierw rownolegle dlugosci wynikow, potem
+//kazdy watek pisze wyniki prosto na ich miejsce w wspolnym buforze. Wartosciowanie i plan
+//sa jedne na watek; plan zbiera kroki (i maski) wszystkich rekordow watku, a drugie przejscie
+//robi ten sam watek na tych samych paczkach, wiec zapisz() czyta kroki z pierwszego
+//przejscia zamiast liczyc je ponownie
+void obliczPakietowo(const Wyrazenie &w, const TabelaWartosciowan &tabela, WynikiPakietu &wyniki,
+                     unsigned watki = 0){
+    static constexpr size_t PACZKA = 64; //rekordow na zadanie
+    size_t n = tabela.liczbaRekordow();
+    size_t zadania = (n + PACZKA - 1) / PACZKA;
+    PulaWatkow &pula = PulaWatkow::wspolna();
+    if (watki == 0 || watki > pula.liczbaWatkow()){
+        watki = pula.liczbaWatkow();
+    }
+    if (watki > zadania){
+        watki = zadania ? static_cast<unsigned>(zadania) : 1;
+    }
+
+    struct Brudnopis{
+        Wartosciowanie wartosciowanie;
+        PlanZapisu plan;
+        vector<size_t> paczki; //zadania wykonane w pierwszym przejsciu
+    };
+    unique_ptr<Brudnopis[]> brudnopisy(new Brudnopis[watki]);
+    vector<size_t> poczatekPlanu(n); //pierwszy krok rekordu w planie jego watku
+    auto wczytajRekord = [&](Wartosciowanie &wart, size_t r){
+        for (size_t k = 0; k < tabela.liczbaKolumn(); k++){
+            wart.ustawWidok(tabela.nazwa(k), tabela.wartosc(k, r));
+        }
+    };
+
+    wyniki.poczatki.assign(n + 1, 0);
+    wyniki.bledy.assign(n, 0);
+    pula.wykonaj(zadania, watki, [&](unsigned t, size_t nr){
+        Brudnopis &b = brudnopisy[t];
+        b.paczki.push_back(nr);
+        for (size_t r = nr * PACZKA; r < n && r < (nr + 1) * PACZKA; r++){
+            wczytajRekord(b.wartosciowanie, r);
+            poczatekPlanu[r] = b.plan.liczbaKrokow();
+            try {
+                wyniki.poczatki[r + 1] = w.zmierz(&b.wartosciowanie, b.plan);
+            }
+            catch (...) {
+                wyniki.bledy[r] = 1;
+            }
+        }
+    });
+    for (size_t r = 0; r < n; r++){
+        wyniki.poczatki[r + 1] += wyniki.poczatki[r];
+    }
+
+    wyniki.dane.resize(wyniki.poczatki[n]);
+    pula.wykonajNaKazdym(watki, [&](unsigned t){
+        Brudnopis &b = brudnopisy[t];
+        for (size_t nr : b.paczki){
+            for (size_t r = nr * PACZKA; r < n && r < (nr + 1) * PACZKA; r++){
+                if (wyniki.bledy[r]){
+                    continue;
+                }
+                wczytajRekord(b.wartosciowanie, r);
+                b.plan.przejdzDo(poczatekPlanu[r]);
+                try {
+                    w.zapisz(&b.wartosciowanie, b.plan, &wyniki.dane[wyniki.poczatki[r]]);
+                }
+                catch (...) {
+                    wyniki.bledy[r] = 1;
+                }
+            }
+        }
+    });
+}
+
 
 int main() {
     cout << "Start programu\n\n";
+    bool jadraZgodne = sprawdzJadra(cout);
+    cout << "\n";
 
     //wartosciowanie
     vector<pair<char, string>> wartosciowanie1 {
         {'b', "C++"},
         {'x', "Python"}
     };
+    Wartosciowanie wart1(wartosciowanie1); //jedna tablica na wszystkie obliczenia
     
     //wyr1: b @ x
     Wyrazenie* wyr1 = new PrzeplotWyrazenie(
@@ -327,9 +1480,9 @@ int main() {
 
     cout << "Wyrazenie 1: " << *wyr1 << "\n";
     cout << "Wynik z wartosciowaniem: "
-         << oblicz(wyr1, true, wartosciowanie1) << "\n";
+         << oblicz(wyr1, &wart1) << "\n";
     cout << "Wynik bez wartosciowania: "
-         << oblicz(wyr1, false) << "\n\n";
+         << oblicz(wyr1, nullptr) << "\n\n";
 
     //wy2: ^("c++") & _("PyThOn")
     Wyrazenie* wyr2 = new PolaczoneWyrazenie(
@@ -339,9 +1492,9 @@ int main() {
 
     cout << "Wyrazenie 2: " << *wyr2 << "\n";
     cout << "Wynik z wartosciowaniem: "
-         << oblicz(wyr2, true, wartosciowanie1) << "\n";
+         << oblicz(wyr2, &wart1) << "\n";
     cout << "Wynik bez wartosciowania: "
-         << oblicz(wyr2, false) << "\n\n";
+         << oblicz(wyr2, nullptr) << "\n\n";
 
     // wyr3: (b * "*") 
     Wyrazenie* wyr3 = new MaskowanieWyrazenie(
@@ -351,24 +1504,54 @@ int main() {
 
     cout << "Wyrazenie 3: " << *wyr3 << "\n";
     cout << "Wynik z wartosciowaniem: "
-         << oblicz(wyr3, true, wartosciowanie1) << "\n";
+         << oblicz(wyr3, &wart1) << "\n";
     cout << "Wynik bez wartosciowania: "
-         << oblicz(wyr3, false) << "\n\n";
+         << oblicz(wyr3, nullptr) << "\n\n";
 
     //wyr4: #(x)
     Wyrazenie* wyr4 = new DlugoscWyrazenie(new ZmiennaWyrazenie('x'));
     cout << "Wyrazenie 4: " << *wyr4 << "\n";
     cout << "Wynik z wartosciowaniem: "
-         << oblicz(wyr4, true, wartosciowanie1) << "\n";
+         << oblicz(wyr4, &wart1) << "\n";
     cout << "Wynik bez wartosciowania: "
-         << oblicz(wyr4, false) << "\n\n";
+         << oblicz(wyr4, nullptr) << "\n\n";
 
 
+    //te same wyrazenia bez kopii posrednich, z jedna lina i jednym buforem
+    Lina lina;
+    string bufor;
+    for (Wyrazenie* w : {wyr1, wyr2, wyr3, wyr4}) {
+        obliczBezKopii(*w, &wart1, lina, bufor);
+        cout << *w << " = " << bufor << "\n";
+    }
+    PlanZapisu plan;
+    for (Wyrazenie* w : {wyr1, wyr2, wyr3, wyr4}) {
+        obliczDwufazowo(*w, &wart1, plan, bufor);
+        cout << *w << " = " << bufor << " (dwufazowo)\n";
+    }
+    cout << "\n";
+
+    //wyr1 dla wielu rekordow naraz
+    TabelaWartosciowan tabela;
+    size_t kolB = tabela.dodajKolumne('b');
+    size_t kolX = tabela.dodajKolumne('x');
+    const char *jezyki[] = {"C++", "Python", "Rust", "Go"};
+    for (int r = 0; r < 4; r++) {
+        tabela.dopisz(kolB, jezyki[r]);
+        tabela.dopisz(kolX, jezyki[3 - r]);
+    }
+    WynikiPakietu wyniki;
+    obliczPakietowo(*wyr1, tabela, wyniki);
+    for (size_t r = 0; r < tabela.liczbaRekordow(); r++) {
+        cout << "rekord " << r << ": " << wyniki.wynik(r) << "\n";
+    }
+    cout << "\n";
+
     delete wyr1;
     delete wyr2;
     delete wyr3;
     delete wyr4;
 
     cout << "Koniec programu\n";
-    return 0;
+    return jadraZgodne ? 0 : 1;
 }